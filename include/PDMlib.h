@@ -36,6 +36,11 @@ struct ContainerInfo
     std::string Suffix;
     int nComp;
     StorageOrder VectorOrder;
+    //! Compressionにquantize(絶対誤差)またはquantize_rel(最大値-最小値に対する相対誤差)を指定した時の許容誤差
+    //
+    //quantize, quantize_relはFLOAT, DOUBLE型のコンテナに対して非可逆の量子化を行う
+    //量子化のみでは圧縮されないので、"quantize-zip"のように圧縮と組み合わせて指定すること
+    double Tolerance;
 };
 
 //! 単位系を表す構造体
@@ -63,6 +68,57 @@ struct TimeSliceInfo
     T MinMax[8];
 };
 
+class PDMlib;
+
+//! PDMlib::ReadView()で読み込んだコンテナのデータを参照する読み込み専用のビュー
+//
+//無圧縮でエンディアン変換が不要なデータが、ファイル内の要素のサイズの境界から連続して格納されている時は
+//ファイルをmmapしてコピーせずに参照します（共有ファイルから全領域を読み込む場合など）
+//それ以外の時はPDMlib::Read()と同じくライブラリ内で確保した領域に読み込みます
+//領域はRelease()を呼んだ時またはビューが破棄される時に解放されます
+template<typename T>
+class ContainerView
+{
+public:
+    ContainerView() : data(NULL), length(0), map_base(NULL), map_size(0){}
+    ~ContainerView()
+    {
+        Release();
+    }
+
+    //! データの先頭へのポインタ
+    const T* Data(void) const
+    {
+        return data;
+    }
+
+    //! データの要素数
+    size_t Length(void) const
+    {
+        return length;
+    }
+
+    //! ファイルをmmapして参照しているかどうか
+    bool IsMapped(void) const
+    {
+        return map_base != NULL;
+    }
+
+    //! 参照している領域を解放する
+    void Release(void);
+
+//non copyable patturn
+private:
+    ContainerView(const ContainerView& obj);
+    ContainerView& operator=(const ContainerView& obj);
+
+    friend class PDMlib;
+    const T* data;
+    size_t   length;
+    void*    map_base; //< mmapした領域の先頭（ライブラリ内の領域に読み込んだ時はNULL）
+    size_t   map_size; //< mmapした領域の大きさ
+};
+
 class PDMlib
 {
 public: 
@@ -116,9 +172,22 @@ public:
     //
     // read_all_filesにtrueが指定された場合は、全Rankが指定されたコンテナ/タイムステップの全データを重複して読み込みます
     // コンバータ等での読み込みなど、通常のデータ分散とは異なる割り当てで読み込む場合に使用する
+    // sharded構成のデータでは、ファイルの一覧をRank0が作って配るので全Rankから呼び出してください
     template<typename T>
     int Read(const std::string& Name, size_t* ContainerLength, T** Container, int* TimeStep = NULL, bool read_all_files = false);
 
+    //! @brief 1コンテナ分のフィールドデータをコピーせずに参照する
+    //! @param [in]    Name             読み込むコンテナの名前
+    //! @param [out]   View             読み込んだデータを参照するビュー  以前に参照していた領域は解放されます
+    //! @param [inout] TimeStep         Read()と同じ
+    //! @param [in]    read_all_files   Read()と同じ
+    //! @return Read()と同じ
+    //
+    // 読み込むデータがmmapで参照できない時は、Read()と同じくライブラリ内で確保した領域に読み込みます
+    // コンバータ等で読み込んだデータを変更せずに使う場合に使用する
+    template<typename T>
+    int ReadView(const std::string& Name, ContainerView<T>* View, int* TimeStep = NULL, bool read_all_files = false);
+
     //! @breif データ読み込みに使用するコンテナを登録する
     //! @param [in] Name      コンテナの名前
     //! @param [in] Container コンテナのデータを格納する領域へのポインタのポインタ
@@ -127,6 +196,7 @@ public:
     //! @return -2 すでに登録済みのコンテナに対してポインタを登録しようとした
     //
     //! 同じ名前のコンテナに対して複数回呼び出したときは、最初に登録されたポインタのみが有効
+    //! 読み込み用のDFIファイルを指定せずにInit()した時は、AddContainer()で追加したコンテナを登録できる（Rebalance()用）
     template<typename T>
     int RegisterContainer(const std::string& Name, T** Container) const;
 
@@ -137,16 +207,30 @@ public:
     //! @return  読み込んだデータの数(ベクトルデータは3要素で1とする）
     size_t ReadAll(int* TimeStep = NULL, const bool& MigrationFlag = false, const std::string& CoordinateContainer = "Coordinate");
 
+    //! @brief RegisterContainer()で登録したコンテナの粒子を座標に従って再分割する
+    //
+    //ReadAll()の後も含めて、計算の途中で何度でも呼び出せます
+    //ロードバランサ（Zoltan）は呼び出し間で保持され、RCBのカットは前回の結果を初期値として更新されるので
+    //移動するのはカットをまたいだ粒子だけです
+    //登録した全てのコンテナはnew[]で確保した領域で、NumParticles個の粒子を格納している必要があります
+    //受信した粒子が入りきらないコンテナは確保し直し、登録したポインタを新しい領域に書き換えます
+    //集団通信を行うので、全Rankから呼び出す必要があります
+    //! @param [in] NumParticles         自Rankの現在の粒子数(ベクトルデータは3要素で1とする）
+    //! @param [in] CoordinateContainer  座標を格納しているコンテナの名前
+    //! @return  再分割後の粒子数  失敗した時は(size_t)-1
+    size_t Rebalance(const size_t& NumParticles, const std::string& CoordinateContainer = "Coordinate");
+
     //! @brief フィールドデータを出力する
     //! @param [in] Name             出力するコンテナの名前（ContainerInfo::Nameで指定した文字列）
     //! @param [in] ContainerLength  出力するデータの要素数
     //! @param [in] Container        データを格納する領域へのポインタ
     //! @param [in] MinMax[8]        出力するデータの最大/最小値を格納する。出力が不要な場合はNULLを渡すこと
+    //!                              SetAutoMinMax(true)の時にNULLを渡すと、ライブラリ内で全Rankの最大/最小値を求めて出力する
     //! @param [in] NumComp          データがスカラー（1)かベクトル（3）かを示す
     //! @param [in] TimeStep         現在のタイムステップ
     //! @param [in] Time             現在の時刻
     //
-    //! @return  0以上 正常終了（出力サイズが返ってくる）
+    //! @return  0以上 正常終了（出力サイズが返ってくる  INT_MAXを越える時はINT_MAX）
     //! @return -1     Init()が呼ばれる前に呼ばれた
     //! @return -2     Tagの値が不正値 （負またはコンテナ数以上の値）
     //! @return -4     ContaierにNULLポインタが指定されていた
@@ -156,6 +240,30 @@ public:
     template<typename T>
     int Write(const std::string&Name, const size_t &ContainerLength, T*Container, T MinMax[8], const int& NumComp, const int& TimeStep, const double& Time);
 
+    //! @brief 出力バッファに溜められているフィールドデータを全てファイルに出力する
+    //
+    // SetBufferSize()またはSetMaxBufferingTime()で出力バッファリングが有効になっている時は
+    // Write()はエンコードしたデータをメモリ上に保持するだけで、ファイル出力は行いません。
+    // タイムスライス情報も、対応するデータがファイルに出力された時点でインデックスファイルに書き込まれます。
+    // バッファ内のデータはデストラクタでも出力されます。
+    void Flush(void);
+
+    //! @brief 非同期出力の有効/無効を設定する
+    //
+    // 非同期出力が有効な時、Write()はデータをライブラリ内の領域にコピーした時点で戻り
+    // 圧縮とファイル出力はI/Oスレッドで行われます。この場合のWrite()の戻り値はコピーしたデータサイズです。
+    // 同じコンテナに対する前回のWrite()の出力が完了していない時は、完了するまで待ってからコピーします。
+    // 共有ファイル出力時は非同期出力は行いません。
+    void SetAsyncWrite(const bool& flag);
+
+    //! @brief 非同期出力の完了を待つ
+    //! @param [in] Name  対象とするコンテナの名前 空文字列の時は全てのコンテナの出力完了を待つ
+    void Wait(const std::string& Name = "");
+
+    //! @brief 非同期出力が完了しているかどうかを返す
+    //! @param [in] Name  対象とするコンテナの名前 空文字列の時は全てのコンテナを対象とする
+    bool Test(const std::string& Name = "");
+
     //
     // 出力用メタデータオブジェクトに対するgetter/setter
     //
@@ -177,6 +285,27 @@ public:
     //! 出力ファイル名のフォーマットを指定します
     int SetFileNameFormat(const std::string& format);
 
+    //! フィールドデータのファイル出力形式を指定します
+    //
+    //! "shared"を指定すると、各コンテナのタイムステップ毎のデータを全Rankで1つのファイルに
+    //! MPI-IOを用いて出力します。それ以外の値を指定した時はRank毎に個別のファイルを出力します。
+    //! 共有ファイル出力時はWrite()はコミュニケータ内の全Rankから呼び出す必要があります。
+    //! 最初のWrite()より前に呼び出してください。
+    //! @return  0 正常終了
+    //! @return -1 Init()が呼ばれる前に呼ばれた
+    //! @return -2 最初のWrite()の後に呼ばれた（出力形式は変更されない）
+    int SetFieldFileMode(const std::string& mode);
+
+    //! フィールドデータのディレクトリ構成を指定します
+    //
+    //! "sharded"を指定すると、出力先ディレクトリの下にタイムステップ毎のディレクトリ（ベースファイル名_step_タイムステップ）
+    //! を作り、さらにRanksPerDirectory個のRank毎のディレクトリ（r先頭Rank-末尾Rank）に分けてファイルを出力します
+    //! 例: pdm/foo_step_000100/r0000-0255/foo_3_100.x
+    //! タイムステップの一覧は出力先ディレクトリの直下だけを見て作れるので、ファイル数が多い場合に有効です
+    //! ディレクトリはグループ毎に作成するので、各タイムステップの最初のWrite()は同じグループの全Rankから呼び出してください
+    //! それ以外の値を指定した時は、従来通り出力先ディレクトリの直下に全てのファイルを出力します
+    int SetDirectoryLayout(const std::string& Layout, const int& RanksPerDirectory = 256);
+
     //
     // 入力用メタデータオブジェクトに対するgetter/setter
     //
@@ -195,26 +324,138 @@ public:
     //! フィールドデータのファイル名フォーマットがrank_stepかどうかを判定します。
     bool is_rank_step(void);
 
+    //! フィールドデータが全Rankで共有する1つのファイルに出力されているかどうかを判定します。
+    bool is_shared_file(void);
+
+    //! フィールドデータがタイムステップ/Rank毎のディレクトリに振り分けられているかどうかを判定します。
+    bool is_sharded(void);
+
     //
     // Setter/Getter for PDMlib parameter
     //
     //!出力バッファのサイズを設定します
+    //
+    //単位はMiB バッファ内のデータ量がこの値を越えた時点でファイルに出力します
+    //0以下の値を指定した場合はサイズによる出力は行いません
     void SetBufferSize(const int& BufferSize);
 
     //!出力バッファのサイズを取得します
     int GetBufferSize(void);
 
     //!出力をバッファリングする最大の回数を設定します。
+    //
+    //MaxBufferingTime回分のタイムステップのデータを保持した状態で、新しいタイムステップの
+    //Write()が呼ばれた時にファイルに出力します
+    //0以下の値を指定した場合は回数による出力は行いません
+    //
+    //SetBufferSize(), SetMaxBufferingTime()のどちらかに正の値を指定すると出力バッファリングが有効になります
+    //ただし、共有ファイル出力時はバッファリングは行いません
+    //非同期出力中のデータがある時は、出力の完了を待ってから設定を変更します（SetBufferSize()も同様）
     void SetMaxBufferingTime(const int& MaxBufferingTime);
 
     //!出力をバッファリングする最大の回数を取得します。
     int GetMaxBufferingTime(void);
 
+    //!temporal符号化でキーフレームを出力する間隔を設定します。
+    //
+    //ContainerInfo::Compressionに"temporal"を指定したコンテナは、直前の出力とのXORを出力し
+    //KeyFrameInterval回に1回はデータをそのまま出力します（デフォルトは10回）
+    //差分のみのファイルを読み込む時は、キーフレームまでの全てのファイルが必要です
+    void SetKeyFrameInterval(const int& KeyFrameInterval);
+
+    //!temporal符号化でキーフレームを出力する間隔を取得します。
+    int GetKeyFrameInterval(void);
+
+    //!Rank毎のファイルの入出力方法を設定します。
+    //
+    //"stream" : std::ofstream/std::ifstreamを使う（デフォルト）
+    //"posix"  : writev/preadを使い、ストリームバッファを経由せずにデータを転送する
+    //"direct" : "posix"に加えて、64MiB以上のファイルはO_DIRECTでページキャッシュを経由せずに読み書きする
+    //いずれの方法でも出力されるファイルの形式は同じです。共有ファイルの入出力には影響しません
+    void SetIOBackend(const std::string& Backend);
+
+    //!Rank毎のファイルの入出力方法を取得します。
+    std::string GetIOBackend(void);
+
+    //!Write()にMinMaxとしてNULLが渡された時に、ライブラリ内で最大/最小値を計算するかどうかを設定します。
+    //
+    //有効にすると、Write()は出力するデータから成分毎（ベクトルの場合は大きさも）の最大/最小値を求め
+    //全Rankの値を集約してタイムスライス情報のインデックスに出力します（デフォルトは無効）
+    //集約は集団通信で行うので、有効にした時は全Rankが同じ順番でWrite()を呼び出す必要があります
+    void SetAutoMinMax(const bool& flag);
+
+    //!Write()内で最大/最小値を計算するかどうかを取得します。
+    bool GetAutoMinMax(void);
+
+    //!Write()内でタイムスライス情報を全Rank分集約するかどうかを設定します。
+    //
+    //有効にすると、Write()は全Rankの粒子数の合計と最大/最小値を1回の集団通信でRank0に集約し
+    //インデックスに記録します（デフォルトは無効で、MinMaxはRank0に渡された値が記録されます）
+    //Rank毎の粒子数と出力サイズは、この設定によらず各Rankがインデックスに記録します
+    //集約は集団通信で行うので、有効にした時は全Rankが同じ順番でWrite()を呼び出す必要があります
+    void SetGlobalTimeSlice(const bool& flag);
+
+    //!Write()内でタイムスライス情報を全Rank分集約するかどうかを取得します。
+    bool GetGlobalTimeSlice(void);
+
+    //!Read()/ReadAll()で、各Rankが読み込む粒子数が均等になるようにするかどうかを設定します。
+    //
+    //無効の時（デフォルト）は、出力時のRank毎のファイルをファイル単位で読み込み側のRankに割り当てます
+    //有効にすると、全ファイルの粒子を出力時のRank番号順に並べて読み込み側のRank数で等分し
+    //各Rankは自Rankの範囲にかかるファイルの必要な部分だけを読み込みます
+    //出力時のRank毎の粒子数はインデックスから求め、インデックスが無い時はファイルのヘッダから求めます
+    //変換無しで格納されたファイル（圧縮無しの共有ファイル等）は必要な範囲だけを読み、それ以外は
+    //ファイル全体を伸張してから必要な範囲を取り出します
+    //粒子数の集約に集団通信を使うので、有効にした時は全Rankが同じ順番でRead()/ReadAll()を呼び出す必要があります
+    void SetBalancedRead(const bool& flag);
+
+    //!Read()/ReadAll()で、各Rankが読み込む粒子数が均等になるようにするかどうかを取得します。
+    bool GetBalancedRead(void);
+
+    //!ReadAll()/Rebalance()の再分割に使うZoltanのパラメータを設定します。
+    //
+    //NameとValueはそのままZoltan::Set_Param()に渡します
+    //デフォルトは LB_METHOD=RCB, IMBALANCE_TOL=1.1, KEEP_CUTS=1, RCB_REUSE=1 です
+    //NUM_GID_ENTRIES等のライブラリ内部で使う値は変更しないでください
+    void SetLoadBalanceParam(const std::string& Name, const std::string& Value);
+
+    //!SetLoadBalanceParam()で設定したZoltanのパラメータを取得します。設定されていない時は空文字列を返します
+    std::string GetLoadBalanceParam(const std::string& Name);
+
+    //!次回のWrite()で全てのコンテナのキーフレームを出力させます。
+    //
+    //temporal符号化は出力毎に粒子の並び順が変わらないことを前提としているので
+    //ソート等でユーザコード側で並び順を変えた時は、次のWrite()より前に呼び出してください
+    //ReadAll()の後とデータ数が変わった時は自動的にキーフレームになります
+    void ForceKeyFrame(void);
+
     //
     // Utility function for converter
     //
     //! 存在するフィールドデータのファイルからタイムステップの一覧を作成して返す
     int MakeTimeStepList(std::set<int>* time_steps, const int& start_time = 0, const int& end_time = INT_MAX, const std::string& wild_card="*") const;
+
+    //! 指定されたタイムステップのフィールドデータのファイルの一覧を作成して返す
+    //
+    // sharded構成のデータではRank0がタイムステップのディレクトリを読んで全Rankに配るので、全Rankから呼び出してください
+    int MakeFileList(std::vector<std::string>* filenames, const int& TimeStep) const;
+
+    //! @brief タイムスライス情報のインデックスに記録された粒子数を返す
+    //
+    //フィールドデータのファイルを開かずに、出力時のRank毎の粒子数や全Rankの合計を求めます
+    //リスタート時に読み込む前の領域確保やファイルの割り当てに使えます
+    //! @param [in] Name     コンテナの名前
+    //! @param [in] TimeStep タイムステップ
+    //! @param [in] Rank     出力時のRank番号  負の値の時は全Rankの合計
+    //! @return -1 インデックスが無い、または出力が完了したタイムステップの記録が無い
+    long GetContainerLength(const std::string& Name, const int& TimeStep, const int& Rank = -1) const;
+
+    //! 読み込み側のフィールドデータのディレクトリを読み直します。
+    //
+    //ディレクトリ内のファイルの一覧はInit()の時にRank0が作って全Rankに配り、以降のRead()や
+    //MakeTimeStepList()ではファイルシステムにアクセスせずにこの一覧を使います
+    //Init()の後に読み込み側のディレクトリにファイルが追加された時は、全Rankから呼び出してください
+    void RefreshFileCatalog(void);
 //
 //pimpl idiom
 //
@@ -0,0 +1,108 @@
+/*
+###################################################################################
+#
+# PDMlib - Particle Data Management library
+#
+# Copyright (c) 2014-2017 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2017 Research Institute for Information Technology (RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+*/
+
+#ifndef PDMLIB_CHUNK_INDEX_H
+#define PDMLIB_CHUNK_INDEX_H
+#include <cstring>
+
+//! チャンク分割して圧縮したデータの先頭に付けるインデックスの定義
+//
+//Encoderの出力は以下の形式になる（数値は全てリトルエンディアンの8Byte整数）
+//  char     magic[4]                    "PDMC"
+//  uint64   num_chunks
+//  uint64   offsets[num_chunks+1]       各チャンクの圧縮データの開始位置（インデックスの先頭から数えたByte数）
+//  uint64   raw_sizes[num_chunks]       各チャンクの圧縮前のデータサイズ
+//  char     chunk data[]
+//
+//圧縮後のサイズが圧縮前のサイズと等しいチャンクは、圧縮せずにそのまま格納されている
+//magicで始まらないデータは、チャンク分割を導入する前の形式（全体で1ストリーム）として扱う
+namespace BaseIO
+{
+namespace ChunkIndex
+{
+//! 1チャンクあたりの圧縮前のデータサイズ（Byte)
+const size_t chunk_size = 4*1024*1024;
+
+const char   magic[4] = {'P', 'D', 'M', 'C'};
+
+//! num_chunks個のチャンクを持つインデックスのサイズ（Byte)
+inline size_t size(const size_t& num_chunks)
+{
+    return sizeof(magic)+8*(2*num_chunks+2);
+}
+
+inline void put(char* dst, size_t value)
+{
+    for(int i = 0; i < 8; i++)
+    {
+        dst[i] = (char)(value & 0xff);
+        value >>= 8;
+    }
+}
+
+inline size_t get(const char* src)
+{
+    size_t value = 0;
+    for(int i = 7; i >= 0; i--)
+    {
+        value = (value<<8) | (unsigned char)src[i];
+    }
+    return value;
+}
+
+//! dataがチャンク分割された形式かどうかを判定する
+inline bool is_chunked(const char* data, const size_t& size)
+{
+    return size >= ChunkIndex::size(0) && memcmp(data, magic, sizeof(magic)) == 0;
+}
+
+inline size_t num_chunks(const char* data)
+{
+    return get(data+sizeof(magic));
+}
+
+inline size_t offset(const char* data, const size_t& i)
+{
+    return get(data+sizeof(magic)+8*(1+i));
+}
+
+inline size_t raw_size(const char* data, const size_t& i)
+{
+    return get(data+sizeof(magic)+8*(2+num_chunks(data)+i));
+}
+//! sizeバイトのdataに格納されたインデックスが指すチャンクが全てdataの範囲内にあるかどうかを判定する
+//
+//チャンクの開始位置はインデックスの後ろから昇順に並んでいなければならない
+inline bool is_valid(const char* data, const size_t& size)
+{
+    const size_t n = num_chunks(data);
+    if(n > size/16 || ChunkIndex::size(n) > size)
+    {
+        return false;
+    }
+    size_t begin = ChunkIndex::size(n);
+    for(size_t i = 0; i < n; i++)
+    {
+        const size_t end = offset(data, i+1);
+        if(offset(data, i) != begin || end < begin || end > size)
+        {
+            return false;
+        }
+        begin = end;
+    }
+    return true;
+}
+} //end of namespace ChunkIndex
+} //end of namespace BaseIO
+#endif
@@ -0,0 +1,193 @@
+/*
+###################################################################################
+#
+# PDMlib - Particle Data Management library
+#
+# Copyright (c) 2014-2017 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2017 Research Institute for Information Technology (RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+*/
+
+#ifndef PDMLIB_DELTA_H
+#define PDMLIB_DELTA_H
+#include <cstring>
+#include <algorithm>
+#include <stdint.h>
+
+//! 整数型コンテナ用のdelta + varint符号化の実装
+//
+//stride要素前の値との差分をzigzag符号化し、7bit毎の可変長整数(LEB128)で出力する
+//ベクトルデータ(NIJK)の場合はstrideに成分数を指定して、成分毎に差分を取る
+//
+//出力形式
+//  char     magic[4]        "PDMD"
+//  uint8    size_of_type    要素のサイズ（4 or 8)
+//  uint8    big_endian      出力したプロセスがビッグエンディアンなら1
+//  uint16   stride          (リトルエンディアン)
+//  uint64   raw_size        符号化前のデータサイズ(リトルエンディアン)
+//  char     varint[]
+//  char     tail[]          size_of_typeで割り切れない末尾のByte（そのまま格納）
+namespace BaseIO
+{
+namespace Delta
+{
+const char   magic[4]    = {'P', 'D', 'M', 'D'};
+const size_t header_size = 16;
+
+inline bool is_big_endian(void)
+{
+    const uint16_t one = 1;
+    return *(const char*)&one == 0;
+}
+
+//! size Byteのデータを符号化した時の最大サイズ
+inline size_t bound(const size_t& size)
+{
+    // 1要素あたり最大で(8*size_of_type+6)/7 Byteなので、8Byteあたり10Byteで抑えられる
+    return header_size+(size+7)/8*10;
+}
+
+template<typename U>
+size_t encode_values(const char* src, const size_t& num_elements, const size_t& stride, char* dst)
+{
+    const int bits = 8*sizeof(U);
+    unsigned char* out = (unsigned char*)dst;
+    for(size_t i = 0; i < num_elements; i++)
+    {
+        U value;
+        U prev = 0;
+        memcpy(&value, src+i*sizeof(U), sizeof(U));
+        if(i >= stride) memcpy(&prev, src+(i-stride)*sizeof(U), sizeof(U));
+        const U diff = value-prev;
+        U       z    = (diff<<1)^((U)0-(diff>>(bits-1)));
+        while(z >= 0x80)
+        {
+            *out++ = (unsigned char)(z|0x80);
+            z    >>= 7;
+        }
+        *out++ = (unsigned char)z;
+    }
+    return out-(unsigned char*)dst;
+}
+
+//! @return 読み込んだByte数 データが不正な時は0
+template<typename U>
+size_t decode_values(const char* src, const size_t& src_size, const size_t& num_elements, const size_t& stride, char* dst)
+{
+    const int            bits = 8*sizeof(U);
+    const unsigned char* in   = (const unsigned char*)src;
+    const unsigned char* end  = in+src_size;
+    for(size_t i = 0; i < num_elements; i++)
+    {
+        U   z     = 0;
+        int shift = 0;
+        for(;;)
+        {
+            if(in == end || shift >= bits) return 0;
+            const unsigned char c = *in++;
+            z     |= (U)(c&0x7f)<<shift;
+            shift += 7;
+            if((c&0x80) == 0) break;
+        }
+        U prev = 0;
+        if(i >= stride) memcpy(&prev, dst+(i-stride)*sizeof(U), sizeof(U));
+        const U value = prev+((z>>1)^((U)0-(z&1)));
+        memcpy(dst+i*sizeof(U), &value, sizeof(U));
+    }
+    return in-(const unsigned char*)src;
+}
+
+inline void put_le(char* dst, uint64_t value, const int& length)
+{
+    for(int i = 0; i < length; i++)
+    {
+        dst[i] = (char)(value&0xff);
+        value >>= 8;
+    }
+}
+
+inline uint64_t get_le(const char* src, const int& length)
+{
+    uint64_t value = 0;
+    for(int i = length-1; i >= 0; i--)
+    {
+        value = (value<<8)|(unsigned char)src[i];
+    }
+    return value;
+}
+
+//! srcを符号化してdstに出力する  dstにはbound(size) Byteの領域を渡すこと
+//! @return 出力サイズ
+inline size_t encode(const char* src, const size_t& size, char* dst, const size_t& size_of_type, const size_t& stride)
+{
+    const size_t num_elements = size/size_of_type;
+    memcpy(dst, magic, sizeof(magic));
+    dst[4] = (char)size_of_type;
+    dst[5] = is_big_endian() ? 1 : 0;
+    put_le(dst+6, stride, 2);
+    put_le(dst+8, size,   8);
+
+    size_t output_size = header_size;
+    if(size_of_type == 8)
+    {
+        output_size += encode_values<uint64_t>(src, num_elements, stride, dst+output_size);
+    }else{
+        output_size += encode_values<uint32_t>(src, num_elements, stride, dst+output_size);
+    }
+    const size_t tail = size-num_elements*size_of_type;
+    memcpy(dst+output_size, src+num_elements*size_of_type, tail);
+    return output_size+tail;
+}
+
+//! srcが符号化されたデータかどうかを判定する
+inline bool is_encoded(const char* src, const size_t& src_size)
+{
+    return src_size >= header_size && memcmp(src, magic, sizeof(magic)) == 0;
+}
+
+//! 符号化前のデータサイズを返す
+inline size_t raw_size(const char* src)
+{
+    return get_le(src+8, 8);
+}
+
+//! srcを復号してdstに出力する  dstにはraw_size() Byteの領域を渡すこと
+//
+//出力したプロセスとエンディアンが異なる時は、後段のConvertEndianで変換できるように
+//出力したプロセスのバイトオーダで返す
+inline bool decode(const char* src, const size_t& src_size, char* dst)
+{
+    const size_t size_of_type = (unsigned char)src[4];
+    const bool   big_endian   = src[5] != 0;
+    const size_t stride       = get_le(src+6, 2);
+    const size_t size         = get_le(src+8, 8);
+    if((size_of_type != 4 && size_of_type != 8) || stride == 0) return false;
+
+    const size_t num_elements = size/size_of_type;
+    size_t       read_size    = 0;
+    if(size_of_type == 8)
+    {
+        read_size = decode_values<uint64_t>(src+header_size, src_size-header_size, num_elements, stride, dst);
+    }else{
+        read_size = decode_values<uint32_t>(src+header_size, src_size-header_size, num_elements, stride, dst);
+    }
+    const size_t tail = size-num_elements*size_of_type;
+    if((num_elements > 0 && read_size == 0) || header_size+read_size+tail != src_size) return false;
+    memcpy(dst+num_elements*size_of_type, src+header_size+read_size, tail);
+
+    if(big_endian != is_big_endian())
+    {
+        for(size_t i = 0; i < num_elements; i++)
+        {
+            std::reverse(dst+i*size_of_type, dst+(i+1)*size_of_type);
+        }
+    }
+    return true;
+}
+} //end of namespace Delta
+} //end of namespace BaseIO
+#endif
@@ -0,0 +1,128 @@
+/*
+###################################################################################
+#
+# PDMlib - Particle Data Management library
+#
+# Copyright (c) 2014-2017 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2017 Research Institute for Information Technology (RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+*/
+
+#ifndef PDMLIB_FILE_CATALOG_H
+#define PDMLIB_FILE_CATALOG_H
+#include <mpi.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+namespace PDMlib
+{
+//! フィールドデータのディレクトリにあるファイルの一覧
+//
+//Rank0だけがディレクトリを読んで、結果を全Rankにブロードキャストする
+//一度作った一覧はbuild()を呼び直すまで使い回すので、タイムステップの検索や
+//読み込むファイルの選択のたびにファイルシステムにアクセスすることは無い
+class FileCatalog
+{
+public:
+    FileCatalog() : valid(false){}
+
+    //! @brief dirnameにあるファイルの一覧を作り直す
+    //
+    //depthに2以上を指定した時はその深さのサブディレクトリ内のファイルまで
+    //"サブディレクトリ名/ファイル名"の形式で一覧に含める
+    //comm内の全Rankから呼び出すこと
+    //ディレクトリを開けなかった時は、must_existがtrueならMPI_Abortし、falseなら空の一覧にする
+    void build(const std::string& dirname, const MPI_Comm& comm, const int& depth = 1, const bool& must_exist = true)
+    {
+        int my_rank;
+        MPI_Comm_rank(comm, &my_rank);
+
+        // ファイル名を'\0'区切りで連結したものをブロードキャストする
+        std::vector<char> buff;
+        if(my_rank == 0)
+        {
+            if(!read_directory(dirname, "", depth, &buff) && must_exist)
+            {
+                std::cerr<<"Couldn't open "<<dirname<<std::endl;
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+        }
+        unsigned long buff_size = buff.size();
+        MPI_Bcast(&buff_size, 1, MPI_UNSIGNED_LONG, 0, comm);
+        buff.resize(buff_size);
+        if(buff_size > 0)
+        {
+            MPI_Bcast(&(buff[0]), buff_size, MPI_CHAR, 0, comm);
+        }
+
+        this->dirname = dirname;
+        names.clear();
+        for(size_t pos = 0; pos < buff_size; pos += names.back().size()+1)
+        {
+            names.push_back(std::string(&(buff[pos])));
+        }
+        std::sort(names.begin(), names.end());
+        valid = true;
+    }
+
+    //! build()済かどうか
+    bool is_valid(void) const {return valid;}
+
+    //! @brief wild_cardに一致するファイルのパスを返す
+    //
+    //ListDirectoryContents()と同じく"ディレクトリ名/ファイル名"の形式で返す
+    void list(std::vector<std::string>* filenames, const std::string& wild_card = "*") const
+    {
+        filenames->clear();
+        for(std::vector<std::string>::const_iterator it = names.begin(); it != names.end(); ++it)
+        {
+            if(fnmatch(wild_card.c_str(), (*it).c_str(), 0) == 0)
+            {
+                filenames->push_back(dirname+"/"+*it);
+            }
+        }
+    }
+
+private:
+    //! @brief dirname/prefix以下のファイル名をprefix付きでbuffに追加する
+    //
+    //depthが1より大きい時はサブディレクトリも読み、ディレクトリ以外のエントリは含めない
+    //@return dirname/prefixを開けなかった時はfalse
+    static bool read_directory(const std::string& dirname, const std::string& prefix, const int& depth, std::vector<char>* buff)
+    {
+        DIR* dp = opendir((prefix.empty() ? dirname : dirname+"/"+prefix).c_str());
+        if(dp == NULL)
+        {
+            return false;
+        }
+        for(struct dirent* entry = readdir(dp); entry != NULL; entry = readdir(dp))
+        {
+            // glob(3)の"*"と同じく、ピリオドから始まるファイルは含めない
+            if(entry->d_name[0] == '.') continue;
+            const std::string name(prefix+entry->d_name);
+            if(depth > 1)
+            {
+                read_directory(dirname, name+"/", depth-1, buff);
+            }else{
+                buff->insert(buff->end(), name.c_str(), name.c_str()+name.size()+1);
+            }
+        }
+        closedir(dp);
+        return true;
+    }
+
+    bool valid;
+    std::string dirname;
+    std::vector<std::string> names;   //< ディレクトリ内のファイル名（ソート済）
+};
+} //end of namespace PDMlib
+#endif
@@ -19,6 +19,8 @@
 #include <map>
 #include <algorithm>
 #include "PDMlib.h"
+#include "FileCatalog.h"
+#include "TimeSliceIndex.h"
 namespace PDMlib
 {
   class MetaData
@@ -27,11 +29,15 @@ namespace PDMlib
       MetaData(std::string arg_filename) : Version("0.2"),
       Comm(MPI_COMM_WORLD),
       Communicator("MPI_COMM_WORLD"),
+      HasIndex(false),
       ReadOnly(false),
-      HeaderOutput(false),
-      DirectoryPath("pdm"),
+      FileName(arg_filename),
       FieldFilenameFormat("rank_step"),
-      FileName(arg_filename)
+      FieldFileMode("file_per_process"),
+      DirectoryPath("pdm"),
+      DirectoryLayout("flat"),
+      RanksPerDirectory(256),
+      StepCatalogStep(-1)
       {
         Endian = GetEndian();
         MPI_Comm_size(Comm, &NumCommWorldProc);
@@ -43,8 +49,6 @@ namespace PDMlib
         }
       }
 
-      ~MetaData();
-
     private:
       //non-copyable
       MetaData(const MetaData& arg);
@@ -52,6 +56,8 @@ namespace PDMlib
 
     public:
       //! MetaData情報を読み込む
+      //
+      //DFIファイルはRank0だけが読み、Comm内の全Rankに内容をブロードキャストする集団操作
       //@return 0: 正常終了
       int Read();
 
@@ -61,14 +67,25 @@ namespace PDMlib
       //Rank0以外では常に何もせずに0を返す
       int Write();
 
-      //! タイムスライス情報を出力する
+      //! @brief タイムスライス情報のインデックスの出力を開始する
       //
-      //!@return 0  正常終了
-      //!@return -1 指定されたコンテナの情報が現在のタイムステップで既に出力されていた
+      //! Rank0がインデックスファイルを作り直してヘッダを書き込むので、他のRankが
+      //! WriteTimeSlice()を呼ぶより前にComm内で同期をとること
+      void OpenTimeSliceIndex(void);
+
+      //! @brief タイムスライス情報をインデックスに記録する
       //
-      //Rank0以外では常に何もせずに0を返す
+      //! 各Rankが自Rankの粒子数と出力したバイト数を記録し、1タイムステップ分の全コンテナが
+      //! 揃った時点でインデックスに書き込む
+      //! Collective=trueの時は、Rank0がRowsに集めた全Rankの値でレコード全体を書き込む
+      //!@param [in] Bytes       このRankが出力したデータのサイズ（エンコード後）
+      //!@param [in] Total       全Rankの粒子数の合計（Rank0のみ有効） 集約していない時は負の値
+      //!@param [in] Collective  全Rankの値をRank0に集めた時はtrue（Comm内の全Rankで同じ値を渡すこと）
+      //!@param [in] Rows        Collectiveの時のRank毎の粒子数と出力サイズ（Rank0のみ参照する  MinMax::gather()を参照）
+      //!@return 0  正常終了
+      //!@return -1 Nameのコンテナが登録されていない
       template<typename T>
-      int WriteTimeSlice(const int& TimeStep, const double& Time, T* MinMax, const int& ContainerLength, const std::string& Name);
+      int WriteTimeSlice(const int& TimeStep, const double& Time, T* MinMax, const size_t& ContainerLength, const std::string& Name, const size_t& Bytes, const int64_t& Total, const bool& Collective, const uint64_t* Rows);
 
       //! このオブジェクトのメンバに対するSetterを無効化する
       void SetReadOnly(void){this->ReadOnly = true;}
@@ -101,6 +118,51 @@ namespace PDMlib
         return FieldFilenameFormat == "rank_step";
       }
 
+      //! フィールドデータのファイル出力形式を設定する
+      //
+      //! "shared"が指定された時は、1タイムステップ/1コンテナ分のデータを
+      //! 全Rankで1つのファイルに出力する。それ以外はRank毎に個別のファイルを出力する
+      //! @return ReadOnlyのため設定しなかった時はfalse
+      bool SetFieldFileMode(const std::string& mode)
+      {
+        if(ReadOnly)return false;
+        std::string mode_lower(mode);
+        std::transform(mode.begin(), mode.end(), mode_lower.begin(), ::tolower);
+        if (mode_lower == "shared")
+        {
+          FieldFileMode="shared";
+        }else {
+          FieldFileMode="file_per_process";
+        }
+        return true;
+      }
+
+      //! フィールドデータが全Rankで共有する1ファイルに出力されているかどうかを判定する
+      bool is_shared_file(void) const
+      {
+        return FieldFileMode == "shared";
+      }
+
+      //! @brief フィールドデータのディレクトリ構成を設定する
+      //
+      //! "sharded"が指定された時は、タイムステップ毎のディレクトリの下に
+      //! ranks_per_directory個のRank毎のディレクトリを作ってファイルを振り分ける
+      //! それ以外はDirectoryPathの直下に全てのファイルを出力する
+      void SetDirectoryLayout(const std::string& layout, const int& ranks_per_directory)
+      {
+        if(ReadOnly)return;
+        std::string layout_lower(layout);
+        std::transform(layout.begin(), layout.end(), layout_lower.begin(), ::tolower);
+        DirectoryLayout   = layout_lower == "sharded" ? "sharded" : "flat";
+        RanksPerDirectory = ranks_per_directory > 0 ? ranks_per_directory : 256;
+      }
+
+      //! フィールドデータがタイムステップ/Rank毎のディレクトリに振り分けられているかどうかを判定する
+      bool is_sharded(void) const
+      {
+        return DirectoryLayout == "sharded";
+      }
+
       //! フィールドデータを格納するディレクトリ名を指定する
       void SetPath(const std::string path){if(!ReadOnly)this->DirectoryPath= path;}
 
@@ -186,8 +248,33 @@ namespace PDMlib
       bool Tag2Name(const int& Tag, std::string* Name) const;
 
       //! 引数で渡された値をもとに、フィールドデータのファイル名を生成する
+      //
+      //! 共有ファイル出力の場合はmy_rankは使われない
       void GetFileName(std::string* filename, const std::string& name, const int my_rank, const int& time_step) const;
 
+      //! @brief 引数で渡された値をもとに、フィールドデータを格納するディレクトリ名を生成する
+      //
+      //! flat    : GetPath()
+      //! sharded : GetPath()/Prefix_step_タイムステップ/r先頭Rank-末尾Rank
+      //!           共有ファイル出力の場合はRank毎のディレクトリは作らない
+      std::string GetFileDirectory(const int my_rank, const int& time_step) const;
+
+      //! @brief GetFileDirectory()で同じディレクトリに出力するRankのグループ番号を返す
+      //
+      //! flat構成と共有ファイル出力の場合は全Rankが同じグループになる
+      int GetDirectoryGroup(const int my_rank) const
+      {
+        return is_sharded() && !is_shared_file() ? my_rank/RanksPerDirectory : 0;
+      }
+
+      //! @brief time_stepのフィールドデータのファイルの一覧を返す
+      //
+      //! flatの場合はRead()時に作ったファイルの一覧から探し、shardedの場合は
+      //! そのタイムステップのディレクトリだけをRank0が読んで全Rankに配る
+      //! shardedの場合は集団操作なので、Comm内の全Rankから同じtime_stepで呼び出すこと
+      //! 同じタイムステップの一覧はRefreshFileCatalog()を呼ぶまで使い回す
+      void ListStepFiles(std::vector<std::string>* filenames, const int& time_step) const;
+
       //! 自Rankのランク番号を返す
       //
       //! 後述のComm内でのRank番号を返す
@@ -203,8 +290,37 @@ namespace PDMlib
       int GetTimeStep(void) const {return this->TimeStep;}
 
       //! 存在するフィールドデータのファイルからタイムステップの一覧を作成して返す
+      //
+      //! shardedの場合はDirectoryPath直下のタイムステップ毎のディレクトリ名から一覧を作り
+      //! wild_cardはディレクトリ名に対して適用する
       void MakeTimeStepList(std::set<int>* time_steps, const int& start_time = 0, const int& end_time = INT_MAX, const std::string& wild_card="*") const;
 
+      //! フィールドデータのディレクトリにあるファイルのうち、wild_cardに一致するものの一覧を返す
+      //
+      //! ファイルの一覧はRead()またはRefreshFileCatalog()の時点のもので、ディレクトリは読み直さない
+      void ListFieldFiles(std::vector<std::string>* filenames, const std::string& wild_card = "*") const;
+
+      //! @brief フィールドデータのディレクトリを読み直して、ファイルの一覧を作り直す
+      //
+      //! Rank0だけがディレクトリを読み、Comm内の全Rankに結果を配る集団操作
+      //! インデックスがあれば、Rank0が読み込んで出力が完了したタイムステップの一覧を配る
+      void RefreshFileCatalog(void);
+
+      //! @brief インデックスに記録された粒子数を返す
+      //
+      //! フィールドデータのファイルは読まずに、インデックスの内容だけから求める
+      //! インデックスは最初に呼ばれた時に呼び出したRankがmmapする
+      //!@param [in] Rank  出力時のRank番号  負の値の時は全Rankの合計
+      //!@return 出力が完了したタイムステップの記録が無い時は-1
+      long GetContainerLength(const std::string& Name, const int& TimeStep, const int& Rank);
+
+      //! @brief インデックスに記録された、出力時のRank毎の粒子数を取得する
+      //
+      //! Rank0がインデックスを読み、Comm内の全Rankに配る集団操作
+      //!@param [out] counts 出力時のRank番号順の粒子数
+      //!@return インデックスに出力が完了したタイムステップの記録が無い時はfalse
+      bool GetParticleCounts(const std::string& Name, const int& TimeStep, std::vector<uint64_t>* counts);
+
       //! 出力結果を読み込み直して、一致するかどうかをテストするためのルーチン
       //
       //! 通常の実行時(以前のジョブ実行結果を読み込む）は一致しないメンバも含まれるので
@@ -212,28 +328,17 @@ namespace PDMlib
       bool Compare(const MetaData& lhs) const;
 
     private:
-      //! 実行中の処理系におけるエンディアンを判定する
-      std::string GetEndian(void) const;
+      //! DFIファイルを読み込んでメンバに格納する
+      void ReadDFI(void);
 
-      //! このタイムステップのタイムスライス情報が1つでも書かれているかどうか調べる
-      bool is_never_written(void)
-      {
-        for(std::map<std::string, bool>::iterator it = Written.begin(); it != Written.end(); ++it)
-        {
-          if((*it).second)return false;
-        }
-        return true;
-      }
+      //! DFIファイルから読み込んだ内容をbuffにシリアライズする
+      void Serialize(std::vector<char>* buff) const;
 
-      //! このタイムステップのタイムスライス情報が全コンテナについて書かれたかどうかを調べる
-      bool is_all_written(void)
-      {
-        for(std::map<std::string, bool>::iterator it = Written.begin(); it != Written.end(); ++it)
-        {
-          if(!(*it).second)return false;
-        }
-        return true;
-      }
+      //! Serialize()で作ったbuffの内容をメンバに格納する
+      void Deserialize(const std::vector<char>& buff);
+
+      //! 実行中の処理系におけるエンディアンを判定する
+      std::string GetEndian(void) const;
 
       //! PDMlibのバージョン
       std::string Version;
@@ -290,11 +395,17 @@ namespace PDMlib
       //! 最新の出力されたコンテナに含まれる粒子数
       long NumParticle;
 
-      //! タイムスライス情報を出力した回数
-      int NumOutputTimeSlice;
+      //! タイムスライス情報のインデックスの出力先
+      TimeSliceIndex::Writer IndexWriter;
+
+      //! タイムスライス情報のインデックスを読み込めたかどうか
+      bool HasIndex;
 
-      //! 現在のタイムステップで各コンテナが出力済かどうかを記録するテーブル
-      std::map<std::string, bool> Written;
+      //! インデックスに記録された、出力が完了したタイムステップの一覧
+      std::vector<int> IndexedSteps;
+
+      //! GetContainerLength()で参照するインデックス
+      TimeSliceIndex::Reader IndexReader;
 
       //! 各変数の値をReadOnlyに設定するフラグ
       bool ReadOnly;
@@ -302,9 +413,6 @@ namespace PDMlib
       //! DFIファイルのファイル名
       std::string FileName;
 
-      //! タイムスライス情報のヘッダ出力を行なったかどうかのフラグ
-      bool HeaderOutput;
-
       //! フィールドデータのベースファイル名
       //
       //! 実際に使われるファイル名は "Prefix_Rank番号_タイムステップ.拡張子”となり
@@ -315,8 +423,27 @@ namespace PDMlib
       //! タイムステップ_Rank番号の順で付与するかを決める
       std::string FieldFilenameFormat;
 
+      //! フィールドデータをRank毎のファイルに出力するか("file_per_process")
+      //! 全Rankで共有する1ファイルに出力するか("shared")を決める
+      std::string FieldFileMode;
+
       //! フィールドデータを格納するディレクトリ名
       std::string DirectoryPath;
+
+      //! フィールドデータのディレクトリ構成("flat" or "sharded")
+      std::string DirectoryLayout;
+
+      //! DirectoryLayoutが"sharded"の時に1つのディレクトリにまとめるRank数
+      int RanksPerDirectory;
+
+      //! DirectoryPathにあるファイルの一覧
+      FileCatalog Catalog;
+
+      //! sharded構成でListStepFiles()が最後に読んだタイムステップのディレクトリにあるファイルの一覧
+      mutable FileCatalog StepCatalog;
+
+      //! StepCatalogのタイムステップ（未作成の時は-1）
+      mutable int StepCatalogStep;
   };
 } //end of namespcae
 #endif
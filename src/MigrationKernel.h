@@ -0,0 +1,211 @@
+/*
+###################################################################################
+#
+# PDMlib - Particle Data Management library
+#
+# Copyright (c) 2014-2017 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2017 Research Institute for Information Technology (RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+*/
+
+#ifndef PDMLIB_MIGRATION_KERNEL_H
+#define PDMLIB_MIGRATION_KERNEL_H
+#include <stdint.h>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include "SparseExchange.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+//! マイグレーションで1コンテナ分の粒子をメッセージに詰める/取り出す処理
+//
+//メッセージの形式
+//  uint64_t 粒子数
+//  コンテナ毎に 粒子数*nComp要素のデータ（NIJK順）を8Byte境界まで0で埋めたもの
+namespace PDMlib
+{
+//! pack/unpackをOpenMPで並列化する最小の粒子数
+const long MigrationParallelThreshold = 16384;
+
+//! メッセージ内のコンテナ毎のデータの先頭を8Byte境界に揃えるためのサイズ
+inline size_t AlignedSize(const size_t& size)
+{
+    return (size+7)/8*8;
+}
+
+//! @brief exportedが0の粒子の番号を昇順にkeptに格納する
+//
+//スレッド毎に担当範囲の粒子数を数え、その累積和を書き込み位置にして並列に詰める
+inline void MakeKeepList(const std::vector<char>& exported, std::vector<size_t>* kept)
+{
+    const long num_particles = exported.size();
+    int        num_threads   = 1;
+#ifdef _OPENMP
+    num_threads = omp_get_max_threads();
+#endif
+    const long          block = (num_particles+num_threads-1)/num_threads;
+    std::vector<size_t> offsets(num_threads+1, 0);
+#pragma omp parallel for if(num_particles > MigrationParallelThreshold)
+    for(long t = 0; t < num_threads; t++)
+    {
+        const long end   = std::min(num_particles, (t+1)*block);
+        size_t     count = 0;
+        for(long i = t*block; i < end; i++)
+        {
+            count += exported[i] == 0;
+        }
+        offsets[t+1] = count;
+    }
+    for(int t = 0; t < num_threads; t++)
+    {
+        offsets[t+1] += offsets[t];
+    }
+    kept->resize(offsets[num_threads]);
+#pragma omp parallel for if(num_particles > MigrationParallelThreshold)
+    for(long t = 0; t < num_threads; t++)
+    {
+        const long end = std::min(num_particles, (t+1)*block);
+        size_t     j   = offsets[t];
+        for(long i = t*block; i < end; i++)
+        {
+            if(exported[i] == 0)
+            {
+                (*kept)[j++] = i;
+            }
+        }
+    }
+}
+
+//! @brief objsで指定された粒子をdstに詰めて、次のコンテナのデータを詰める位置を返す
+//
+//粒子毎に全成分を並べるので、メッセージ内の並びはVectorOrderによらずNIJKになる
+//! @param [in] src           コンテナのデータ（num_particles*nComp要素）
+//! @param [in] nijk          srcの並びがNIJKの時はtrue, IJKNの時はfalse
+template<typename T, typename ID>
+char* PackParticles(const T* src, const size_t& num_particles, const size_t& nComp, const bool& nijk, const std::vector<ID>& objs, char* dst)
+{
+    T*         out      = (T*)dst;
+    const long num_objs = objs.size();
+    if(nComp == 1)
+    {
+#pragma omp parallel for if(num_objs > MigrationParallelThreshold)
+        for(long i = 0; i < num_objs; i++)
+        {
+            out[i] = src[objs[i]];
+        }
+    }else if(nijk){
+#pragma omp parallel for if(num_objs > MigrationParallelThreshold)
+        for(long i = 0; i < num_objs; i++)
+        {
+            for(size_t k = 0; k < nComp; k++)
+            {
+                out[i*nComp+k] = src[objs[i]*nComp+k];
+            }
+        }
+    }else{
+#pragma omp parallel for if(num_objs > MigrationParallelThreshold)
+        for(long i = 0; i < num_objs; i++)
+        {
+            for(size_t k = 0; k < nComp; k++)
+            {
+                out[i*nComp+k] = src[k*num_particles+objs[i]];
+            }
+        }
+    }
+    return dst+AlignedSize(num_objs*nComp*sizeof(T));
+}
+
+//! @brief keptの粒子を前に詰め、受信した粒子を末尾に追加した領域を返す
+//
+//粒子数が増える時は新しい領域に組み立ててsrcをdelete[]し、それ以外はscratchに組み立ててからsrcにコピーする
+//scratchは全コンテナで使い回す
+//戻り値の領域の粒子数は kept.size()+num_recv になる
+//! @param [in]    num_recv  全送信元からの受信粒子数の合計
+//! @param [inout] positions 送信元Rank毎の、受信データ内のこのコンテナのデータの位置
+template<typename T>
+T* UnpackParticles(T* src, const size_t& num_particles, const size_t& nComp, const bool& nijk, const std::vector<size_t>& kept, const size_t& num_recv, const MessageMap& recv_buffs, std::map<int, size_t>* positions, std::vector<char>* scratch)
+{
+    const long   num_keep = kept.size();
+    const size_t num_new  = num_keep+num_recv;
+    const bool   grow     = num_new > num_particles;
+    const bool   packed   = nijk || nComp == 1;
+
+    T* dst = NULL;
+    if(grow)
+    {
+        dst = new T[num_new*nComp];
+    }else{
+        if(scratch->size() < num_new*nComp*sizeof(T)+1)
+        {
+            scratch->resize(num_new*nComp*sizeof(T)+1);
+        }
+        dst = (T*)&((*scratch)[0]);
+    }
+
+    if(packed)
+    {
+#pragma omp parallel for if(num_keep > MigrationParallelThreshold)
+        for(long j = 0; j < num_keep; j++)
+        {
+            for(size_t k = 0; k < nComp; k++)
+            {
+                dst[j*nComp+k] = src[kept[j]*nComp+k];
+            }
+        }
+    }else{
+        for(size_t k = 0; k < nComp; k++)
+        {
+            T*       dst_k = dst+k*num_new;
+            const T* src_k = src+k*num_particles;
+#pragma omp parallel for if(num_keep > MigrationParallelThreshold)
+            for(long j = 0; j < num_keep; j++)
+            {
+                dst_k[j] = src_k[kept[j]];
+            }
+        }
+    }
+
+    size_t base = num_keep;
+    for(MessageMap::const_iterator it = recv_buffs.begin(); it != recv_buffs.end(); ++it)
+    {
+        size_t&    position = (*positions)[it->first];
+        const T*   in       = (const T*)&(it->second[position]);
+        const long num_objs = *(const uint64_t*)&(it->second[0]);
+        if(packed)
+        {
+            memcpy(dst+base*nComp, in, num_objs*nComp*sizeof(T));
+        }else{
+            for(size_t k = 0; k < nComp; k++)
+            {
+                T* dst_k = dst+k*num_new+base;
+#pragma omp parallel for if(num_objs > MigrationParallelThreshold)
+                for(long i = 0; i < num_objs; i++)
+                {
+                    dst_k[i] = in[i*nComp+k];
+                }
+            }
+        }
+        base     += num_objs;
+        position += AlignedSize(num_objs*nComp*sizeof(T));
+    }
+
+    if(grow)
+    {
+        delete[] src;
+        return dst;
+    }
+    if(num_new > 0)
+    {
+        memcpy(src, dst, num_new*nComp*sizeof(T));
+    }
+    return src;
+}
+} //end of namespace PDMlib
+#endif
@@ -0,0 +1,371 @@
+/*
+###################################################################################
+#
+# PDMlib - Particle Data Management library
+#
+# Copyright (c) 2014-2017 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2017 Research Institute for Information Technology (RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+*/
+
+#ifndef PDMLIB_MIN_MAX_H
+#define PDMLIB_MIN_MAX_H
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+#include <mpi.h>
+#include "PDMlib.h"
+
+//! Write()に渡されたデータからタイムスライス情報のMinMax値を求める実装
+//
+//MinMaxの並びはTimeSliceInfo::MinMaxと同じ
+//  スカラ   : 0,1に最小/最大値
+//  ベクトル : 0,1に大きさの最小/最大値、2-7に成分毎の最小/最大値
+//
+//データはblock_size要素毎にスレッドに割り当てて、1ブロック分をキャッシュに載せたまま
+//コピーと最小/最大値の計算を続けて行う
+namespace PDMlib
+{
+namespace MinMax
+{
+//! 1スレッドが一度に処理する要素数
+const size_t block_size = 4096;
+
+//! 最小値の初期値（Tの最大値）
+template<typename T>
+T initial_min(void)
+{
+    return std::numeric_limits<T>::max();
+}
+
+//! 最大値の初期値（Tの最小値）
+template<typename T>
+T initial_max(void)
+{
+    return std::numeric_limits<T>::is_integer ? std::numeric_limits<T>::min() : -std::numeric_limits<T>::max();
+}
+
+//! スカラデータの最小/最大値を求める
+template<typename T>
+void scalar(const T* src, T* dst, const size_t& length, T MinMax[8])
+{
+    const long num_blocks = (length+block_size-1)/block_size;
+    T          min        = initial_min<T>();
+    T          max        = initial_max<T>();
+#pragma omp parallel for schedule(static) reduction(min:min) reduction(max:max)
+    for(long b = 0; b < num_blocks; b++)
+    {
+        const size_t begin = b*block_size;
+        const size_t end   = std::min(length, begin+block_size);
+        if(dst != NULL) memcpy(dst+begin, src+begin, (end-begin)*sizeof(T));
+        for(size_t i = begin; i < end; i++)
+        {
+            min = src[i] < min ? src[i] : min;
+            max = src[i] > max ? src[i] : max;
+        }
+    }
+    MinMax[0] = min;
+    MinMax[1] = max;
+}
+
+//! ベクトルデータの成分毎と大きさの最小/最大値を求める
+//
+//i番目の要素のc成分はsrc[i*stride+c*offset]にある
+//  NIJK : stride=3, offset=1
+//  IJKN : stride=1, offset=length
+template<typename T>
+void vector(const T* src, T* dst, const size_t& length, const size_t& stride, const size_t& offset, T MinMax[8])
+{
+    const long num_blocks = (length+block_size-1)/block_size;
+    T          min_x      = initial_min<T>();
+    T          max_x      = initial_max<T>();
+    T          min_y      = initial_min<T>();
+    T          max_y      = initial_max<T>();
+    T          min_z      = initial_min<T>();
+    T          max_z      = initial_max<T>();
+    double     min_r2     = std::numeric_limits<double>::max();
+    double     max_r2     = 0.0;
+#pragma omp parallel for schedule(static) reduction(min:min_x, min_y, min_z, min_r2) reduction(max:max_x, max_y, max_z, max_r2)
+    for(long b = 0; b < num_blocks; b++)
+    {
+        const size_t begin = b*block_size;
+        const size_t end   = std::min(length, begin+block_size);
+        if(dst != NULL && stride == 3)
+        {
+            memcpy(dst+begin*3, src+begin*3, (end-begin)*3*sizeof(T));
+        }else if(dst != NULL){
+            for(size_t c = 0; c < 3; c++)
+            {
+                memcpy(dst+begin+c*offset, src+begin+c*offset, (end-begin)*sizeof(T));
+            }
+        }
+        const T* x = src+offset*0;
+        const T* y = src+offset*1;
+        const T* z = src+offset*2;
+        for(size_t i = begin; i < end; i++)
+        {
+            const T      vx = x[i*stride];
+            const T      vy = y[i*stride];
+            const T      vz = z[i*stride];
+            const double r2 = (double)vx*vx+(double)vy*vy+(double)vz*vz;
+            min_x  = vx < min_x ? vx : min_x;
+            max_x  = vx > max_x ? vx : max_x;
+            min_y  = vy < min_y ? vy : min_y;
+            max_y  = vy > max_y ? vy : max_y;
+            min_z  = vz < min_z ? vz : min_z;
+            max_z  = vz > max_z ? vz : max_z;
+            min_r2 = r2 < min_r2 ? r2 : min_r2;
+            max_r2 = r2 > max_r2 ? r2 : max_r2;
+        }
+    }
+    MinMax[0] = length > 0 ? (T)std::sqrt(min_r2) : initial_min<T>();
+    MinMax[1] = length > 0 ? (T)std::sqrt(max_r2) : initial_max<T>();
+    MinMax[2] = min_x;
+    MinMax[3] = max_x;
+    MinMax[4] = min_y;
+    MinMax[5] = max_y;
+    MinMax[6] = min_z;
+    MinMax[7] = max_z;
+}
+
+//! @brief ローカルなデータのMinMax値を求める
+//! @param [in]  src       Write()に渡されたデータ
+//! @param [out] dst       NULL以外の時はsrcの内容をコピーする
+//! @param [in]  length    要素数（ベクトルデータは3成分で1とする）
+//! @param [in]  NumComp   1 or 3
+//! @param [in]  NIJK_Flag ベクトルデータの格納順がNIJKならtrue
+//! @param [out] MinMax    求めた値 データが無い時は最小値にTの最大値、最大値にTの最小値が入る
+template<typename T>
+void compute(const T* src, T* dst, const size_t& length, const int& NumComp, const bool& NIJK_Flag, T MinMax[8])
+{
+    if(NumComp == 1)
+    {
+        scalar(src, dst, length, MinMax);
+        for(int i = 2; i < 8; i += 2)
+        {
+            MinMax[i]   = initial_min<T>();
+            MinMax[i+1] = initial_max<T>();
+        }
+    }else if(NIJK_Flag){
+        vector(src, dst, length, 3, 1, MinMax);
+    }else{
+        vector(src, dst, length, 1, length, MinMax);
+    }
+}
+
+inline MPI_Datatype mpi_type(int*){return MPI_INT;}
+inline MPI_Datatype mpi_type(unsigned int*){return MPI_UNSIGNED;}
+inline MPI_Datatype mpi_type(long*){return MPI_LONG;}
+inline MPI_Datatype mpi_type(unsigned long*){return MPI_UNSIGNED_LONG;}
+inline MPI_Datatype mpi_type(float*){return MPI_FLOAT;}
+inline MPI_Datatype mpi_type(double*){return MPI_DOUBLE;}
+
+//! @brief 各RankのMinMax値をRank0に集約する
+//
+//集団操作なので、comm内の全Rankから呼び出すこと
+//! @return 全Rankにデータが無い時はfalse（Rank0以外では常にtrue)
+template<typename T>
+bool reduce(T MinMax[8], MPI_Comm comm)
+{
+    T local[8];
+    T global[8];
+    for(int i = 0; i < 4; i++)
+    {
+        local[i]   = MinMax[2*i];
+        local[4+i] = MinMax[2*i+1];
+    }
+    MPI_Reduce(local,   global,   4, mpi_type(local), MPI_MIN, 0, comm);
+    MPI_Reduce(local+4, global+4, 4, mpi_type(local), MPI_MAX, 0, comm);
+
+    int my_rank;
+    MPI_Comm_rank(comm, &my_rank);
+    if(my_rank != 0) return true;
+    for(int i = 0; i < 4; i++)
+    {
+        MinMax[2*i]   = global[i];
+        MinMax[2*i+1] = global[4+i];
+    }
+    return MinMax[0] <= MinMax[1];
+}
+
+//! reduce()で粒子数と合わせて集約する時の1Rank分の値
+//
+//最小値と最大値はコンテナの型のまま、粒子数はuint64_tのまま集約するので値は丸められない
+template<typename T>
+struct Summary
+{
+    T        min[4];
+    T        max[4];
+    uint64_t num_particles;
+};
+
+//! Summary<T>の最小値/最大値をとり、粒子数の合計をとるMPI_Op用の関数
+template<typename T>
+void summary_op(void* in, void* inout, int* len, MPI_Datatype* /*datatype*/)
+{
+    const Summary<T>* src = static_cast<const Summary<T>*>(in);
+    Summary<T>*       dst = static_cast<Summary<T>*>(inout);
+    for(int i = 0; i < *len; i++, src++, dst++)
+    {
+        for(int j = 0; j < 4; j++)
+        {
+            dst->min[j] = std::min(dst->min[j], src->min[j]);
+            dst->max[j] = std::max(dst->max[j], src->max[j]);
+        }
+        dst->num_particles += src->num_particles;
+    }
+}
+
+//! summary_type<T>()が作る型とMPI_Op
+template<typename T>
+struct SummaryType
+{
+    MPI_Datatype datatype;
+    MPI_Op       op;
+};
+
+//! @brief summary_type<T>()が作った型とMPI_Opを解放する属性削除コールバック
+//
+//MPI_Finalize()は他の処理より先にMPI_COMM_SELFの属性を削除するので、この時点ではまだ解放できる
+template<typename T>
+int free_summary_type(MPI_Comm /*comm*/, int keyval, void* attribute_val, void* /*extra_state*/)
+{
+    SummaryType<T>* summary = static_cast<SummaryType<T>*>(attribute_val);
+    MPI_Type_free(&(summary->datatype));
+    MPI_Op_free(&(summary->op));
+    MPI_Comm_free_keyval(&keyval);
+    return MPI_SUCCESS;
+}
+
+//! summary_op<T>()を適用する型とMPI_Op
+//
+//MPIの実装が要素の途中で分割しないように、1Rank分の値を1要素の派生データ型にする
+//型とMPI_OpはTごとに最初の呼び出し時に作り、以降は使い回す
+//作った型とMPI_OpはMPI_COMM_SELFの属性に登録しておき、MPI_Finalize()の時に解放する
+template<typename T>
+void summary_type(MPI_Datatype* datatype, MPI_Op* op)
+{
+    static SummaryType<T> summary = {MPI_DATATYPE_NULL, MPI_OP_NULL};
+    if(summary.datatype == MPI_DATATYPE_NULL)
+    {
+        int          block_lengths[2] = {8, 1};
+        MPI_Aint     displacements[2] = {offsetof(Summary<T>, min), offsetof(Summary<T>, num_particles)};
+        MPI_Datatype types[2]         = {mpi_type((T*)NULL), MPI_UINT64_T};
+        MPI_Datatype tmp;
+        MPI_Type_create_struct(2, block_lengths, displacements, types, &tmp);
+        MPI_Type_create_resized(tmp, 0, sizeof(Summary<T>), &(summary.datatype));
+        MPI_Type_free(&tmp);
+        MPI_Type_commit(&(summary.datatype));
+        MPI_Op_create(summary_op<T>, 1, &(summary.op));
+
+        int keyval;
+        MPI_Comm_create_keyval(MPI_COMM_NULL_COPY_FN, free_summary_type<T>, &keyval, NULL);
+        MPI_Comm_set_attr(MPI_COMM_SELF, keyval, &summary);
+    }
+    *datatype = summary.datatype;
+    *op       = summary.op;
+}
+
+//! @brief 各RankのMinMax値と粒子数を1回の集団通信でRank0に集約する
+//
+//集団操作なので、comm内の全Rankから呼び出すこと
+//MinMaxが無いRankはMinMaxに各成分の初期値（initial_min(), initial_max()）を入れて呼び出すこと
+//! @param [inout] MinMax         Rank0では全Rankの最大/最小値が返る
+//! @param [inout] num_particles  Rank0では全Rankの合計が返る
+//! @return 全Rankにデータが無い時はfalse（Rank0以外では常にtrue)
+template<typename T>
+bool reduce(T MinMax[8], uint64_t* num_particles, MPI_Comm comm)
+{
+    Summary<T> local;
+    Summary<T> global;
+    for(int i = 0; i < 4; i++)
+    {
+        local.min[i] = MinMax[2*i];
+        local.max[i] = MinMax[2*i+1];
+    }
+    local.num_particles = *num_particles;
+
+    MPI_Datatype datatype;
+    MPI_Op       op;
+    summary_type<T>(&datatype, &op);
+    MPI_Reduce(&local, &global, 1, datatype, op, 0, comm);
+
+    int my_rank;
+    MPI_Comm_rank(comm, &my_rank);
+    if(my_rank != 0) return true;
+    for(int i = 0; i < 4; i++)
+    {
+        MinMax[2*i]   = global.min[i];
+        MinMax[2*i+1] = global.max[i];
+    }
+    *num_particles = global.num_particles;
+    return global.min[0] <= global.max[0];
+}
+
+//! gather()で集める1Rank分の値
+template<typename T>
+struct Row
+{
+    Summary<T> summary;
+    uint64_t   num_bytes;
+};
+
+//! @brief 各RankのMinMax値、粒子数、出力サイズを1回の集団通信でRank0に集める
+//
+//Rank0では全Rankの値をsummary_op<T>()と同じ規則で集約し、Rank毎の粒子数と出力サイズも返す
+//集団操作なので、comm内の全Rankから呼び出すこと
+//MinMaxが無いRankはMinMaxに各成分の初期値（initial_min(), initial_max()）を入れて呼び出すこと
+//! @param [inout] MinMax         Rank0では全Rankの最大/最小値が返る
+//! @param [inout] num_particles  Rank0では全Rankの合計が返る
+//! @param [in]    num_bytes      自Rankの出力サイズ
+//! @param [out]   rows           Rank0ではRank毎の粒子数と出力サイズが交互に返る（Rank0以外では変更しない）
+//! @return 全Rankにデータが無い時はfalse（Rank0以外では常にtrue)
+template<typename T>
+bool gather(T MinMax[8], uint64_t* num_particles, const uint64_t& num_bytes, std::vector<uint64_t>* rows, MPI_Comm comm)
+{
+    int my_rank;
+    int num_procs;
+    MPI_Comm_rank(comm, &my_rank);
+    MPI_Comm_size(comm, &num_procs);
+
+    Row<T> local;
+    for(int i = 0; i < 4; i++)
+    {
+        local.summary.min[i] = MinMax[2*i];
+        local.summary.max[i] = MinMax[2*i+1];
+    }
+    local.summary.num_particles = *num_particles;
+    local.num_bytes             = num_bytes;
+
+    std::vector<Row<T> > all(my_rank == 0 ? num_procs : 0);
+    MPI_Gather(&local, sizeof(Row<T>), MPI_BYTE, my_rank == 0 ? &(all[0]) : NULL, sizeof(Row<T>), MPI_BYTE, 0, comm);
+    if(my_rank != 0) return true;
+
+    Summary<T> global = all[0].summary;
+    rows->resize(2*num_procs);
+    for(int i = 0; i < num_procs; i++)
+    {
+        int len = 1;
+        if(i > 0) summary_op<T>(&(all[i].summary), &global, &len, NULL);
+        (*rows)[2*i]   = all[i].summary.num_particles;
+        (*rows)[2*i+1] = all[i].num_bytes;
+    }
+    for(int i = 0; i < 4; i++)
+    {
+        MinMax[2*i]   = global.min[i];
+        MinMax[2*i+1] = global.max[i];
+    }
+    *num_particles = global.num_particles;
+    return global.min[0] <= global.max[0];
+}
+} //end of namespace MinMax
+} //end of namespace PDMlib
+#endif
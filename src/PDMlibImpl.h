@@ -15,21 +15,26 @@
 #ifndef PDMLIB_PDMLIB_IMPL_H
 #define PDMLIB_PDMLIB_IMPL_H
 #include <vector>
+#include <deque>
+#include <map>
 #include <typeinfo>
+#include <cstring>
+#include <algorithm>
+#include <pthread.h>
 #include "zoltan_cpp.h"
 #include "Utility.h"
 #include "MetaData.h"
+#include "MinMax.h"
 #include "Read.h"
+#include "PosixIO.h"
+#include "Write.h"
+#include "SparseExchange.h"
+#include "MigrationKernel.h"
 #ifdef _OPENMP
 #include <omp.h>
 #endif
 #include <set>
 
-//forward declaration
-namespace BaseIO
-{
-class Write;
-}
 namespace PDMlib
 {
 struct ContainerPointer
@@ -44,20 +49,155 @@ struct ContainerPointer
     bool NIJK_Flag;                //< データの格納順がNIJKであればtrue, IJKNであればfalse
 };
 
+//! 読み込み対象のフィールドデータを表す構造体
+struct FieldFile
+{
+    std::string filename;          //< ファイル名
+    int region;                    //< 共有ファイル内の領域番号（Rank毎のファイルの場合は-1）
+    bool partial;                  //< ファイル内の一部の粒子だけを読むかどうか
+    size_t first;                  //< partialの時に読む最初の粒子の番号
+    size_t count;                  //< partialの時に読む粒子数
+};
+
+//! 出力バッファ内に保持されているタイムスライス情報
+//
+//MinMaxの型がコンテナ毎に異なるので、型毎の実装はTypedTimeSliceEntryで行う
+class TimeSliceEntry
+{
+public:
+    virtual ~TimeSliceEntry(){}
+
+    //! 保持しているタイムスライス情報をメタデータに出力する
+    //! @param [in] bytes      出力したデータのサイズ（エンコード後）
+    //! @param [in] collective trueの時は全Rankの値をRank0に集めてから出力する（全Rankが同じ順序で呼び出すこと）
+    virtual void commit(MetaData* meta_data, const size_t& bytes, const bool& collective) = 0;
+};
+
+//collectiveでcommit()する時は、MinMaxと粒子数を出力サイズと合わせて1回の集団通信で集約する
+//この時はコンストラクタには自Rankの値を渡し、totalが0以上の時は全Rankの合計に置き換える
+template<typename T>
+class TypedTimeSliceEntry: public TimeSliceEntry
+{
+public:
+    TypedTimeSliceEntry(const int& arg_time_step, const double& arg_time, const T* arg_min_max, const size_t& arg_container_length, const std::string& arg_name, const int64_t& arg_total)
+        : time_step(arg_time_step), time(arg_time), has_min_max(arg_min_max != NULL), container_length(arg_container_length), name(arg_name), total(arg_total)
+    {
+        for(int i = 0; i < 8 && has_min_max; i++)
+        {
+            min_max[i] = arg_min_max[i];
+        }
+    }
+
+    void commit(MetaData* meta_data, const size_t& bytes, const bool& collective)
+    {
+        if(!collective)
+        {
+            meta_data->WriteTimeSlice(time_step, time, has_min_max ? min_max : (T*)NULL, container_length, name, bytes, total, false, (uint64_t*)NULL);
+            return;
+        }
+        for(int i = 0; i < 8 && !has_min_max; i += 2)
+        {
+            min_max[i]   = MinMax::initial_min<T>();
+            min_max[i+1] = MinMax::initial_max<T>();
+        }
+        uint64_t              num_particles = container_length;
+        std::vector<uint64_t> rows;
+        has_min_max = MinMax::gather(min_max, &num_particles, bytes, &rows, meta_data->GetComm());
+        if(total >= 0) total = num_particles;
+        meta_data->WriteTimeSlice(time_step, time, has_min_max ? min_max : (T*)NULL, container_length, name, bytes, total, true, rows.empty() ? (uint64_t*)NULL : &(rows[0]));
+    }
+
+private:
+    int time_step;
+    double time;
+    bool has_min_max;
+    T min_max[8];
+    size_t container_length;
+    std::string name;
+    int64_t total;
+};
+
+//! 出力バッファ内に保持されている1回分のWrite()の内容
+struct BufferedOutput
+{
+    std::string filename;          //< 出力先のファイル名
+    BaseIO::MemoryBlock block;     //< エンコード済のデータ（出力するデータが無い時はdata=NULL）
+    TimeSliceEntry* time_slice;    //< ファイル出力後にメタデータに書き込むタイムスライス情報
+};
+
+//! コンテナ毎に保持して再利用するエンコーダチェーン
+//
+//最初の出力時に出力先毎に生成し、以降のWrite()では同じオブジェクトを使い回す
+struct EncodePipeline
+{
+    BaseIO::Write* file_writer;        //< Rank毎のファイルに出力するチェーン
+    BaseIO::Write* shared_writer;      //< 共有ファイルに出力するチェーン
+    BaseIO::Write* memory_writer;      //< memory_blockに出力するチェーン
+    BaseIO::MemoryBlock memory_block;  //< memory_writerの出力先
+};
+
+//! 1回分のWrite()で行うファイル出力の内容
+struct WriteJob
+{
+    std::string filename;          //< 出力先のファイル名
+    ContainerInfo container_info;  //< 出力するコンテナの情報
+    size_t size;                   //< dataのデータ長（Byte)
+    char* data;                    //< 出力するデータ（非同期出力時はライブラリ内にコピーした領域）
+    int time_step;                 //< タイムステップ
+    TimeSliceEntry* time_slice;    //< 出力するタイムスライス情報
+    bool collective;               //< タイムスライス情報を全Rankで集めてインデックスに書き込むかどうか
+};
+
 //! PDMlibの実装を提供するクラス
 class PDMlib::Impl
 {
 public:
-    Impl() : Initialized(false),
-        FirstCall(true),
+    Impl() : BufferSize(0),
+        MaxBufferingTime(0),
+        KeyFrameInterval(10),
+        AutoMinMax(false),
+        GlobalTimeSlice(false),
+        BalancedRead(false),
+        IOBackend("stream"),
+        LoadBalancer(NULL),
+        BufferedBytes(0),
+        AsyncWrite(false),
+        AsyncWriteRequested(false),
+        IOThreadRunning(false),
+        IOThreadStop(false),
+        NumPendingJobs(0),
         WriteDFI_FileName("PDMlib.dfi"),
+        Initialized(false),
+        FirstCall(true),
+        LastDirectoryStep(-1),
+        DirectoryComm(MPI_COMM_NULL),
+        DirectoryNodeComm(MPI_COMM_NULL),
         rMetaData(NULL),
         wMetaData(NULL),
         PM(false)
-    {}
+    {
+        pthread_mutex_init(&JobMutex, NULL);
+        pthread_cond_init(&JobQueued, NULL);
+        pthread_cond_init(&JobDone,   NULL);
+
+        // ロードバランスのパラメータの初期値
+        // 前回のRCBのカットを保持して次回の初期値に使うので、再分割で移動するのはカットをまたいだ粒子だけになる
+        LoadBalanceParams["LB_METHOD"]     = "RCB"; // パーティショニングのアルゴリズム
+        LoadBalanceParams["IMBALANCE_TOL"] = "1.1"; // 110%以下のインバランスは許容する
+        LoadBalanceParams["KEEP_CUTS"]     = "1";   // 分割結果をZoltanオブジェクト内に保持する
+        LoadBalanceParams["RCB_REUSE"]     = "1";   // 前回のカットを初期値として使う
+    }
 
     ~Impl()
     {
+        // 非同期出力中のデータとバッファに残っているデータは
+        // タイムスライス情報を出力する前に全てファイルに書き出す
+        StopIOThread();
+        Flush();
+        ResetPipelines();
+        pthread_mutex_destroy(&JobMutex);
+        pthread_cond_destroy(&JobQueued);
+        pthread_cond_destroy(&JobDone);
         int myrank=wMetaData->GetMyRank();
         delete wMetaData;
         wMetaData = NULL;
@@ -67,6 +207,22 @@ public:
         {
             delete *it;
         }
+        // MPI_Finalize()の後はZoltan_Destroy()やMPI_Comm_free()を呼び出せないので解放しない
+        int finalized;
+        MPI_Finalized(&finalized);
+        if(!finalized)
+        {
+            delete LoadBalancer;
+            if(DirectoryComm != MPI_COMM_NULL)
+            {
+                MPI_Comm_free(&DirectoryComm);
+            }
+            if(DirectoryNodeComm != MPI_COMM_NULL)
+            {
+                MPI_Comm_free(&DirectoryNodeComm);
+            }
+        }
+        LoadBalancer = NULL;
         if(PM)
         {
           std::stringstream ss;
@@ -164,12 +320,326 @@ public:
         Initialized    = true;
     }
 
+    //! Rank毎のファイルへの1回分の出力を行う
+    //
+    //出力バッファリングが有効な時はバッファに積むだけで、ファイル出力はFlush()で行う
+    //同期出力時はWrite()から、非同期出力時はI/Oスレッドから呼ばれる
+    //@return エンコード後のデータサイズ
+    ssize_t ExecuteWrite(const WriteJob& job)
+    {
+        if(is_buffering())
+        {
+            return WriteToBuffer(job.filename, job.container_info, job.size, job.data, job.time_step, job.time_slice);
+        }
+
+        //出力するデータサイズが0の時はタイムスライスだけ出力する
+        ssize_t write_size = 0;
+        if(job.size > 0)
+        {
+            EncodePipeline& pipeline = GetPipeline(job.container_info);
+            if(pipeline.file_writer == NULL)
+            {
+                pipeline.file_writer = BaseIO::WriteFactory::create(job.container_info.Compression, enumType2string(job.container_info.Type), job.container_info.nComp, false, ',', job.container_info.Tolerance, KeyFrameInterval, IOBackend);
+            }
+            write_size = pipeline.file_writer->write(job.filename.c_str(), job.size, job.size, job.data);
+        }
+
+        //ファイル出力後に、出力したサイズと合わせてタイムスライス情報を記録する
+        job.time_slice->commit(wMetaData, write_size > 0 ? write_size : 0, job.collective);
+        delete job.time_slice;
+        return write_size;
+    }
+
+    //! 全コンテナのエンコーダチェーンを破棄する
+    //
+    //temporal符号化で保持している直前の出力データも破棄されるので、次の出力はキーフレームになる
+    //非同期出力中のジョブがある時は完了を待ってから破棄する
+    void ResetPipelines(void)
+    {
+        Wait("");
+        for(std::map<std::string, EncodePipeline>::iterator it = Pipelines.begin(); it != Pipelines.end(); ++it)
+        {
+            delete (*it).second.file_writer;
+            delete (*it).second.shared_writer;
+            delete (*it).second.memory_writer;
+        }
+        Pipelines.clear();
+    }
+
+    //! コンテナのエンコーダチェーンを取得する
+    //
+    //各チェーンは使う時に生成するので、呼び出し側でNULLチェックすること
+    EncodePipeline& GetPipeline(const ContainerInfo& container_info)
+    {
+        std::map<std::string, EncodePipeline>::iterator it = Pipelines.find(container_info.Name);
+        if(it == Pipelines.end())
+        {
+            EncodePipeline pipeline;
+            pipeline.file_writer                = NULL;
+            pipeline.shared_writer              = NULL;
+            pipeline.memory_writer              = NULL;
+            pipeline.memory_block.original_size = 0;
+            pipeline.memory_block.actual_size   = 0;
+            pipeline.memory_block.data          = NULL;
+            it = Pipelines.insert(std::make_pair(container_info.Name, pipeline)).first;
+        }
+        return (*it).second;
+    }
+
+    //! 非同期出力を行うかどうかを判定する
+    //
+    //共有ファイル出力はMPIの集団操作なので、I/Oスレッドでは実行しない
+    bool is_async(void) const
+    {
+        return AsyncWrite && !wMetaData->is_shared_file();
+    }
+
+    //! @brief タイムスライス情報を全Rankで集めてインデックスに書き込むかどうかを判定する
+    //
+    //Write()内で全Rankの統計値を集約していて、タイムスライス情報をWrite()の中で記録する時だけtrueを返す
+    //I/Oスレッドを起動できずに同期出力に切り替えたRankがあっても判定が揃うように、SetAsyncWrite()で指定された値で判定する
+    //! @param [in] reduced Write()内で全Rankの統計値を集約したかどうか
+    bool is_collective_time_slice(const bool& reduced) const
+    {
+        if(!reduced) return false;
+        if(wMetaData->is_shared_file()) return true;
+        return !AsyncWriteRequested && !is_buffering();
+    }
+
+    //! データをライブラリ内の領域にコピーしてI/Oスレッドに出力を依頼する
+    //
+    //同じコンテナの前回の出力が終わっていない時は、終わるまで待ってからコピーする
+    //したがって、コンテナ毎にライブラリ内で保持するデータは最大1回分となる
+    //@return コピーしたデータサイズ
+    //
+    //staged=trueの時は、呼び出し側でWait()した後にnew[]で確保したコピーがjob.dataに入っているものとして、そのまま使う
+    //
+    //I/Oスレッドを起動できなかった時は非同期出力を止めて、呼び出したスレッドで出力する
+    ssize_t PostWriteJob(WriteJob job, const bool& staged = false)
+    {
+        if(!StartIOThread())
+        {
+            AsyncWrite = false;
+            ssize_t write_size = ExecuteWrite(job);
+            if(staged)
+            {
+                delete[] job.data;
+            }
+            return write_size;
+        }
+        const std::string& name = job.container_info.Name;
+        pthread_mutex_lock(&JobMutex);
+        while(InFlight[name] > 0)
+        {
+            pthread_cond_wait(&JobDone, &JobMutex);
+        }
+        InFlight[name]++;
+        NumPendingJobs++;
+        pthread_mutex_unlock(&JobMutex);
+
+        if(!staged)
+        {
+            char* copy = NULL;
+            if(job.size > 0)
+            {
+                copy = new char[job.size];
+                memcpy(copy, job.data, job.size);
+            }
+            job.data = copy;
+        }
+
+        pthread_mutex_lock(&JobMutex);
+        JobQueue.push_back(job);
+        pthread_cond_signal(&JobQueued);
+        pthread_mutex_unlock(&JobMutex);
+        return job.size;
+    }
+
+    //! 指定されたコンテナの非同期出力が完了するまで待つ
+    //
+    //nameが空文字列の時は全てのコンテナの出力完了を待つ
+    void Wait(const std::string& name)
+    {
+        pthread_mutex_lock(&JobMutex);
+        while(!is_done(name))
+        {
+            pthread_cond_wait(&JobDone, &JobMutex);
+        }
+        pthread_mutex_unlock(&JobMutex);
+    }
+
+    //! 指定されたコンテナの非同期出力が完了しているかどうかを返す
+    bool Test(const std::string& name)
+    {
+        pthread_mutex_lock(&JobMutex);
+        bool rt = is_done(name);
+        pthread_mutex_unlock(&JobMutex);
+        return rt;
+    }
+
+    //! I/Oスレッドを起動する（起動済の時は何もしない）
+    //@return I/Oスレッドが動いていればtrue
+    bool StartIOThread(void)
+    {
+        if(IOThreadRunning) return true;
+        IOThreadStop = false;
+        if(pthread_create(&IOThread, NULL, IOThreadMain, this) != 0)
+        {
+            std::cerr<<"failed to create I/O thread! falling back to synchronous write"<<std::endl;
+            return false;
+        }
+        IOThreadRunning = true;
+        return true;
+    }
+
+    //! 全ての非同期出力の完了を待ってI/Oスレッドを終了させる
+    void StopIOThread(void)
+    {
+        if(!IOThreadRunning) return;
+        pthread_mutex_lock(&JobMutex);
+        IOThreadStop = true;
+        pthread_cond_signal(&JobQueued);
+        pthread_mutex_unlock(&JobMutex);
+        pthread_join(IOThread, NULL);
+        IOThreadRunning = false;
+    }
+
+    //! I/Oスレッドの本体
+    static void* IOThreadMain(void* arg)
+    {
+        Impl* impl = static_cast<Impl*>(arg);
+        while(true)
+        {
+            pthread_mutex_lock(&(impl->JobMutex));
+            while(impl->JobQueue.empty() && !impl->IOThreadStop)
+            {
+                pthread_cond_wait(&(impl->JobQueued), &(impl->JobMutex));
+            }
+            if(impl->JobQueue.empty())
+            {
+                pthread_mutex_unlock(&(impl->JobMutex));
+                break;
+            }
+            WriteJob job = impl->JobQueue.front();
+            impl->JobQueue.pop_front();
+            pthread_mutex_unlock(&(impl->JobMutex));
+
+            impl->ExecuteWrite(job);
+            delete[] job.data;
+
+            pthread_mutex_lock(&(impl->JobMutex));
+            impl->InFlight[job.container_info.Name]--;
+            impl->NumPendingJobs--;
+            pthread_cond_broadcast(&(impl->JobDone));
+            pthread_mutex_unlock(&(impl->JobMutex));
+        }
+        return NULL;
+    }
+
+    //! 出力バッファリングを行うかどうかを判定する
+    //
+    //共有ファイル出力は集団操作なので、Rank毎にタイミングが異なるバッファリングは行わない
+    bool is_buffering(void) const
+    {
+        return (BufferSize > 0 || MaxBufferingTime > 0) && !wMetaData->is_shared_file();
+    }
+
+    //! データをエンコードして出力バッファに積む
+    //
+    //MaxBufferingTime回分のタイムステップのデータが既にバッファにある状態で
+    //新しいタイムステップのデータが渡された時、またはバッファ内のデータ量が
+    //BufferSize(MiB)を越えた時はFlush()を呼んでファイルに出力する
+    //
+    //@return エンコード後のデータサイズ
+    ssize_t WriteToBuffer(const std::string& filename, const ContainerInfo& container_info, const size_t& size, char* data, const int& time_step, TimeSliceEntry* time_slice)
+    {
+        if(MaxBufferingTime > 0 && BufferedSteps.size() >= (size_t)MaxBufferingTime && BufferedSteps.find(time_step) == BufferedSteps.end())
+        {
+            Flush();
+        }
+
+        BufferedOutput output;
+        output.filename            = filename;
+        output.block.original_size = 0;
+        output.block.actual_size   = 0;
+        output.block.data          = NULL;
+        output.time_slice          = time_slice;
+        if(size > 0)
+        {
+            EncodePipeline& pipeline = GetPipeline(container_info);
+            if(pipeline.memory_writer == NULL)
+            {
+                pipeline.memory_writer = BaseIO::WriteFactory::create(container_info.Compression, enumType2string(container_info.Type), container_info.nComp, &(pipeline.memory_block), container_info.Tolerance, KeyFrameInterval);
+            }
+            pipeline.memory_writer->write(filename.c_str(), size, size, data);
+            output.block = pipeline.memory_block;
+            pipeline.memory_block.data = NULL;
+        }
+        OutputBuffer.push_back(output);
+        BufferedSteps.insert(time_step);
+        BufferedBytes += output.block.actual_size;
+
+        if(BufferSize > 0 && BufferedBytes >= (size_t)BufferSize*1024*1024)
+        {
+            Flush();
+        }
+        return output.block.actual_size;
+    }
+
+    //! JobMutexをロックした状態で呼ぶこと
+    bool is_done(const std::string& name)
+    {
+        if(name.empty()) return NumPendingJobs == 0;
+        std::map<std::string, int>::iterator it = InFlight.find(name);
+        return it == InFlight.end() || (*it).second == 0;
+    }
+
+    //! 出力バッファ内のデータを全てファイルに出力した後、対応するタイムスライス情報を出力する
+    //
+    //ファイル出力に失敗したデータのタイムスライス情報は、ExecuteWrite()と同じく出力サイズ0として記録する
+    void Flush(void)
+    {
+        if(OutputBuffer.empty()) return;
+        // バッファ内のデータはエンコード済なので、全て同じファイル出力オブジェクトで出力する
+        BaseIO::Write*       writer = BaseIO::WriteFactory::create("", "", 1, false, ',', 0.0, KeyFrameInterval, IOBackend);
+        std::vector<ssize_t> write_sizes(OutputBuffer.size(), 0);
+        for(size_t i = 0; i < OutputBuffer.size(); i++)
+        {
+            BufferedOutput& output = OutputBuffer[i];
+            if(output.block.data == NULL) continue;
+            write_sizes[i] = writer->write(output.filename.c_str(), output.block.original_size, output.block.actual_size, output.block.data);
+            if(write_sizes[i] != (ssize_t)output.block.actual_size)
+            {
+                std::cerr<<"failed to write buffered field data ("<<output.filename<<")"<<std::endl;
+                write_sizes[i] = 0;
+            }
+            delete[] output.block.data;
+        }
+        delete writer;
+        for(size_t i = 0; i < OutputBuffer.size(); i++)
+        {
+            OutputBuffer[i].time_slice->commit(wMetaData, write_sizes[i], false);
+            delete OutputBuffer[i].time_slice;
+        }
+        OutputBuffer.clear();
+        BufferedSteps.clear();
+        BufferedBytes = 0;
+    }
+
+    //! @brief RegisterContainer()で登録するコンテナの情報を持つメタデータを返す
+    //
+    //読み込み用のDFIファイルが無い（Rebalance()だけに使う）時は出力用のメタデータを使う
+    MetaData* GetRegisterMetaData(void)
+    {
+        return rMetaData != NULL ? rMetaData : wMetaData;
+    }
+
     //! コンテナの型がメタデータファイルに書かれた型と適合するか確認する
     template<typename T>
     bool TypeCheck(const std::string& name, T** Container)
     {
         ContainerInfo container_info;
-        rMetaData->GetContainerInfo(name, &container_info);
+        GetRegisterMetaData()->GetContainerInfo(name, &container_info);
         if(container_info.Type == INT32)
         {
             if(typeid(T) != typeid(int))return false;
@@ -189,7 +659,7 @@ public:
         return true;
     }
 
-    //! カレントディレクトリ以下にあるファイルを元にタイムステップのリストを作る
+    //! Init()時に作ったファイルの一覧を元にタイムステップのリストを作る
     void MakeTimeStep(std::set<int>* time_steps)
     {
         rMetaData->MakeTimeStepList(time_steps);
@@ -213,30 +683,34 @@ public:
     }
 
     //! 自ランクが読み込むファイルのリストを作る
-    void MakeFilenameList(std::vector<std::string>* filenames, const int& time_step, const std::string& name, bool read_all_files = false)
+    void MakeFilenameList(std::vector<FieldFile>* filenames, const int& time_step, const std::string& name, bool read_all_files = false)
     {
-        if(read_all_files)
+        const bool shared = rMetaData->is_shared_file();
+        if(read_all_files && shared)
         {
+            FieldFile field_file = {"", -1, false, 0, 0};
+            rMetaData->GetFileName(&(field_file.filename), name, 0, time_step);
+            for(int i = 0; i < rMetaData->GetNumProc(); i++)
+            {
+                field_file.region = i;
+                filenames->push_back(field_file);
+            }
+        }else if(read_all_files){
             std::vector<std::string> tmp_filenames;
-            ListDirectoryContents(rMetaData->GetPath(), &tmp_filenames);
-            std::string   tail1("_");
-            tail1 += to_string(time_step);
+            rMetaData->ListStepFiles(&tmp_filenames, time_step);
             ContainerInfo container_info;
             rMetaData->GetContainerInfo(name, &container_info);
-            tail1 += "."+container_info.Suffix;
+            const std::string suffix("."+container_info.Suffix);
             for(std::vector<std::string>::iterator it = tmp_filenames.begin(); it != tmp_filenames.end(); ++it)
             {
-                int pos_underbar = (*it).find_last_of('_');
-                if(pos_underbar != std::string::npos)
+                if((*it).size() > suffix.size() && (*it).compare((*it).size()-suffix.size(), suffix.size(), suffix) == 0)
                 {
-                    std::string tail((*it).substr(pos_underbar));
-                    if(tail == tail1)
-                    {
-                        filenames->push_back(*it);
-                    }
+                    FieldFile field_file = {*it, -1, false, 0, 0};
+                    filenames->push_back(field_file);
                 }
             }
-            std::sort(filenames->begin(), filenames->end());
+        }else if(BalancedRead){
+            MakeBalancedFilenameList(filenames, time_step, name);
         }else{
             int M       = rMetaData->GetNumProc();
             int N       = wMetaData->GetNumProc();
@@ -246,289 +720,471 @@ public:
 
             for(int i = start; i < end; i++)
             {
-                std::string filename;
-                rMetaData->GetFileName(&filename, name, i, time_step);
-                filenames->push_back(filename);
+                filenames->push_back(MakeFieldFile(name, i, time_step));
             }
         }
     }
 
-    //! 必要なファイルを全て読んで、読み込んだデータへのポインタを格納したvectorを作る
-    void Read(const std::string& name, const std::vector<std::string>& filenames, std::vector<std::pair<size_t, char*> >* buffers, size_t* total_size)
+    //! 出力時のRank番号がrankのファイル全体を読むFieldFileを作る
+    FieldFile MakeFieldFile(const std::string& name, const int& rank, const int& time_step)
     {
-        ContainerInfo container_info;
-        rMetaData->GetContainerInfo(name, &container_info);
-        for(std::vector<std::string>::const_iterator it = filenames.begin(); it != filenames.end(); ++it)
-        {
-            BaseIO::Read* reader = BaseIO::ReadFactory::create(*it, container_info.Compression, enumType2string(container_info.Type), container_info.nComp);
-            size_t tmp;
-            char** read_buff = new char*;
-            *read_buff   = NULL;
-            size_t read_size = reader->read(tmp, read_buff);
-            *total_size += read_size;
-            buffers->push_back(std::make_pair(read_size, *read_buff));
-            delete reader;
-        }
+        FieldFile field_file = {"", rMetaData->is_shared_file() ? rank : -1, false, 0, 0};
+        rMetaData->GetFileName(&(field_file.filename), name, rank, time_step);
+        return field_file;
     }
 
-    // Containerに領域を確保する
-    template<typename T>
-    void AllocateContainer(const size_t& total_size, const size_t& ContainerLength, T** Container)
+    //! @brief 各Rankが読む粒子数が均等になるように、自Rankが読むファイルと範囲を決める
+    //
+    //全ファイルの粒子を出力時のRank番号順に並べて読み込み側のRank数で等分し、自Rankの範囲に
+    //かかるファイルを、範囲にかかる部分だけ読むように登録する
+    //出力時のRank毎の粒子数はインデックスから求め、インデックスが無い時は各Rankがファイルを分担して
+    //ヘッダを読んで集める
+    //集団操作なので、comm内の全Rankから呼び出すこと
+    void MakeBalancedFilenameList(std::vector<FieldFile>* filenames, const int& time_step, const std::string& name)
     {
-        size_t length = total_size/sizeof(T);
-        if(length > ContainerLength)
+        std::vector<uint64_t> counts;
+        if(!rMetaData->GetParticleCounts(name, time_step, &counts))
         {
-            delete *Container;
-            *Container = NULL;
+            GatherParticleCounts(name, time_step, &counts);
         }
-        if(*Container == NULL)
+
+        std::vector<ParticleRange> ranges;
+        GetBalancedRanges(counts, wMetaData->GetNumProc(), wMetaData->GetMyRank(), &ranges);
+        for(std::vector<ParticleRange>::iterator it = ranges.begin(); it != ranges.end(); ++it)
         {
-            *Container = new T[length];
+            FieldFile field_file = MakeFieldFile(name, (*it).file, time_step);
+            field_file.first   = (*it).first;
+            field_file.count   = (*it).count;
+            field_file.partial = (*it).count != counts[(*it).file];
+            filenames->push_back(field_file);
         }
     }
 
-    //! buffersに格納されたポインタをContainerが指す領域にコピーする
-    template<typename T>
-    void CopyBufferToContainer(const std::vector<std::pair<size_t, char*> >&  buffers, size_t* ContainerLength, T* Container)
+    //! @brief 各Rankがファイルを分担してヘッダを読み、出力時のRank毎の粒子数を集める
+    //
+    //集団操作なので、comm内の全Rankから呼び出すこと
+    void GatherParticleCounts(const std::string& name, const int& time_step, std::vector<uint64_t>* counts)
     {
-        *ContainerLength = 0;
-        for(std::vector<std::pair<size_t, char*> >::const_iterator it = buffers.begin(); it != buffers.end(); ++it)
+        ContainerInfo container_info;
+        rMetaData->GetContainerInfo(name, &container_info);
+        const size_t particle_size = container_info.nComp*GetSize(container_info.Type);
+
+        const int        M     = rMetaData->GetNumProc();
+        const int        N     = wMetaData->GetNumProc();
+        std::vector<int> recvcounts(N);
+        std::vector<int> displs(N+1, 0);
+        for(int i = 0; i < N; i++)
         {
-            *ContainerLength += CopyBufferToContainer(Container+*ContainerLength, (*it).second, (*it).first);
-            delete (*it).second;
+            displs[i+1]   = GetStartIndex(M, N, i+1);
+            recvcounts[i] = displs[i+1]-displs[i];
         }
-    }
 
-    template<typename T>
-    size_t CopyBufferToContainer(T* Container, const char* buffer, const size_t& size)
-    {
-        size_t length = size/sizeof(T);
-        for(int i = 0; i < length; i++)
+        const int             my_rank = wMetaData->GetMyRank();
+        std::vector<uint64_t> local(recvcounts[my_rank]+1, 0);
+        for(int i = 0; i < recvcounts[my_rank]; i++)
         {
-            Container[i] = ((T*)buffer)[i];
+            const FieldFile field_file = MakeFieldFile(name, displs[my_rank]+i, time_step);
+            BaseIO::Read*   reader     = BaseIO::ReadFactory::create(field_file.filename, container_info.Compression, enumType2string(container_info.Type), container_info.nComp, field_file.region, IOBackend);
+            size_t          original_size = 0;
+            if(reader->read_header(original_size) > 0)
+            {
+                local[i] = original_size/particle_size;
+            }
+            delete reader;
         }
-        return length;
-    }
-
-    int Send(int* buf, int count, int dest, int tag, MPI_Comm comm)
-    {
-        return MPI_Send(buf, count, MPI_INT, dest, tag, comm);
-    }
-
-    int Send(unsigned int* buf, int count, int dest, int tag, MPI_Comm comm)
-    {
-        return MPI_Send(buf, count, MPI_UNSIGNED, dest, tag, comm);
-    }
-
-    int Send(long* buf, int count, int dest, int tag, MPI_Comm comm)
-    {
-        return MPI_Send(buf, count, MPI_LONG, dest, tag, comm);
-    }
-
-    int Send(unsigned long* buf, int count, int dest, int tag, MPI_Comm comm)
-    {
-        return MPI_Send(buf, count, MPI_UNSIGNED_LONG, dest, tag, comm);
+        counts->resize(M);
+        MPI_Allgatherv(&(local[0]), recvcounts[my_rank], MPI_UINT64_T, &((*counts)[0]), &(recvcounts[0]), &(displs[0]), MPI_UINT64_T, wMetaData->GetComm());
     }
 
-    int Send(float* buf, int count, int dest, int tag, MPI_Comm comm)
+    //! @brief ファイル内の粒子番号[first, first+count)の範囲のデータをdstに読み込む
+    //
+    //変換無しでファイルに格納されている時は、範囲内のデータだけをpreadで読む
+    //それ以外の時はファイル全体を伸張してから範囲内のデータをコピーする
+    //IJKNのベクトルデータは、成分毎に連続したcount要素ずつを並べて格納する
+    //! @param [in] original_size ファイル全体の伸張後のサイズ
+    //! @return 読み込んだデータのサイズ（Byte)  失敗した時は負の値
+    ssize_t ReadRange(BaseIO::Read* reader, const FieldFile& field_file, const ContainerInfo& container_info, const size_t& original_size, char* dst)
     {
-        return MPI_Send(buf, count, MPI_FLOAT, dest, tag, comm);
-    }
-
-    int Send(double* buf, int count, int dest, int tag, MPI_Comm comm)
-    {
-        return MPI_Send(buf, count, MPI_DOUBLE, dest, tag, comm);
-    }
-
-    int Irecv(int* buf, int count, int source, int tag, MPI_Comm comm, MPI_Request* request)
-    {
-        return MPI_Irecv(buf, count, MPI_INT, source, tag, comm, request);
-    }
-
-    int Irecv(unsigned int* buf, int count, int source, int tag, MPI_Comm comm, MPI_Request* request)
-    {
-        return MPI_Irecv(buf, count, MPI_UNSIGNED, source, tag, comm, request);
-    }
-
-    int Irecv(long* buf, int count, int source, int tag, MPI_Comm comm, MPI_Request* request)
-    {
-        return MPI_Irecv(buf, count, MPI_LONG, source, tag, comm, request);
-    }
+        const size_t element_size  = GetSize(container_info.Type);
+        const bool   planar        = container_info.nComp > 1 && container_info.VectorOrder == IJKN;
+        const size_t num_particles = original_size/(container_info.nComp*element_size);
+
+        // 読む範囲（ファイル内のデータ先頭からのオフセットとサイズ）
+        const size_t num_ranges = planar ? container_info.nComp : 1;
+        const size_t range_size = field_file.count*element_size*(planar ? 1 : container_info.nComp);
+        std::vector<size_t> range_offsets(num_ranges);
+        for(size_t k = 0; k < num_ranges; k++)
+        {
+            range_offsets[k] = planar ? (k*num_particles+field_file.first)*element_size : field_file.first*container_info.nComp*element_size;
+        }
 
-    int Irecv(unsigned long* buf, int count, int source, int tag, MPI_Comm comm, MPI_Request* request)
-    {
-        return MPI_Irecv(buf, count, MPI_UNSIGNED_LONG, source, tag, comm, request);
-    }
+        std::string extent_filename;
+        size_t      extent_offset = 0;
+        size_t      extent_size   = 0;
+        if(reader->get_raw_extent(extent_filename, extent_offset, extent_size))
+        {
+            const int fd = ::open(extent_filename.c_str(), O_RDONLY);
+            bool      ok = fd >= 0;
+            for(size_t k = 0; k < num_ranges && ok; k++)
+            {
+                ok = BaseIO::PosixIO::pread_all(fd, dst+k*range_size, range_size, extent_offset+range_offsets[k]);
+            }
+            if(fd >= 0) ::close(fd);
+            return ok ? (ssize_t)(num_ranges*range_size) : -1;
+        }
 
-    int Irecv(float* buf, int count, int source, int tag, MPI_Comm comm, MPI_Request* request)
-    {
-        return MPI_Irecv(buf, count, MPI_FLOAT, source, tag, comm, request);
+        char*         buff = new char[original_size];
+        size_t        size = 0;
+        const ssize_t rc   = reader->read_into(size, buff, original_size);
+        for(size_t k = 0; k < num_ranges && rc >= 0; k++)
+        {
+            memcpy(dst+k*range_size, buff+range_offsets[k], range_size);
+        }
+        delete[] buff;
+        return rc < 0 ? -1 : (ssize_t)(num_ranges*range_size);
     }
 
-    int Irecv(double* buf, int count, int source, int tag, MPI_Comm comm, MPI_Request* request)
+    //! @brief 必要なファイルを全て読んで、Containerに直接格納する
+    //
+    //先に全ファイルのヘッダを読んで伸張後のサイズを求め、Containerの領域を1回だけ確保してから
+    //各ファイルのデータを格納先のオフセットに直接読み込む
+    //複数のファイルを読む時は、ファイル毎にOpenMPのスレッドに割り当てて読み込みと伸張を並列に行う
+    //格納先のオフセットはヘッダから先に決まるので、データの並び順はスレッド数によらず一定
+    //IJKNのベクトルデータを複数のファイルから読む時は、一旦ファイル毎に連続して読み込んでから
+    //成分毎に全ファイル分が連続するように並べ替える
+    //! @param [in]     name            コンテナ名
+    //! @param [in]     filenames       読み込むファイルのリスト
+    //! @param [in,out] Container       データの格納先  領域が足りない時は確保し直す
+    //! @param [in]     ContainerLength 確保済のContainerの要素数
+    //! @return 読み込んだデータのサイズ（Byte)
+    template<typename T>
+    size_t ReadFiles(const std::string& name, const std::vector<FieldFile>& filenames, T** Container, const size_t& ContainerLength)
     {
-        return MPI_Irecv(buf, count, MPI_DOUBLE, source, tag, comm, request);
-    }
+        ContainerInfo container_info;
+        rMetaData->GetContainerInfo(name, &container_info);
 
-    template<typename T>
-    void migrate_container(T** Container, size_t* ContainerLength, int* recv_counts, const size_t nComp, const std::vector<std::vector<ZOLTAN_ID_TYPE>*>& export_objs)
-    {
-        pm_begin("migrate_container: prepare to receive");
-        // 受信バッファを確保しつつMPI_Irecvを発行
-        const int    num_procs  = export_objs.size();
-        T**          recv_buffs = new T*[num_procs];
-        MPI_Request* requests   = new MPI_Request[num_procs];
-        int          src_rank   = 0;
-        int          num_recv   = 0;
-        for(int i = 0; i < num_procs; i++)
-        {
-            if(recv_counts[i] > 0)
+        const long                 num_files = filenames.size();
+        const bool                 planar    = num_files > 1 && container_info.nComp > 1 && container_info.VectorOrder == IJKN;
+        // ContainerPointer::buffに読む時はTがcharなので、要素のサイズはコンテナの型から求める
+        const size_t               element_size  = GetSize(container_info.Type);
+        const size_t               particle_size = container_info.nComp*element_size;
+        std::vector<BaseIO::Read*> readers(num_files, (BaseIO::Read*)NULL);
+        std::vector<size_t>        original_sizes(num_files, 0);
+        std::vector<size_t>        sizes(num_files, 0);
+#pragma omp parallel for schedule(dynamic) if(num_files > 1)
+        for(long i = 0; i < num_files; i++)
+        {
+            BaseIO::Read* reader = BaseIO::ReadFactory::create(filenames[i].filename, container_info.Compression, enumType2string(container_info.Type), container_info.nComp, filenames[i].region, IOBackend);
+            size_t original_size = 0;
+            if(reader->read_header(original_size) <= 0)
             {
-                recv_buffs[src_rank] = new T[recv_counts[i]*nComp];
-                Irecv(recv_buffs[src_rank], recv_counts[i]*nComp, src_rank, MPI_ANY_TAG, wMetaData->GetComm(), &(requests[i]));
-                num_recv++;
-            }else{
-                recv_buffs[src_rank] = NULL;
+                delete reader;
+                continue;
             }
-            src_rank++;
+            readers[i]        = reader;
+            original_sizes[i] = original_size;
+            sizes[i]          = filenames[i].partial ? filenames[i].count*particle_size : original_size;
         }
-        pm_end("migrate_container: prepare to receive");
-        pm_begin("migrate_container: prepare to send");
 
-        // count number of items to send
-        std::vector<T*> send_buffs(num_procs);
-        std::vector<int> indices(num_procs);
-        for(int i = 0; i < num_procs; i++)
+        std::vector<size_t> offsets(num_files+1, 0);
+        for(long i = 0; i < num_files; i++)
         {
-          if((export_objs[i])->size() > 0)
-          {
-            send_buffs[i] = new T [(export_objs[i])->size() * nComp];
-          }else{
-            send_buffs[i] = NULL;
-          }
-          indices[i]=0;
+            offsets[i+1] = offsets[i]+sizes[i];
         }
-
-        // 転送するデータを転送バッファにコピー
-        std::vector<ZOLTAN_ID_TYPE> export_ids;
-        for(int dst_rank = 0; dst_rank < num_procs; dst_rank++)
+        const size_t total_size = offsets[num_files];
+        if(total_size > 0 && !planar)
         {
-          for (std::vector<ZOLTAN_ID_TYPE>::iterator it = export_objs[dst_rank]->begin(); it != export_objs[dst_rank]->end(); ++it)
-          {
-            for ( int i=0; i<nComp; i++)
-            {
-              send_buffs[dst_rank][indices[dst_rank]]=(*Container)[(*it)*nComp+i];
-              indices[dst_rank]=indices[dst_rank]+1;
-              export_ids.push_back((*it)*nComp+i);
-            }
-          }
+            AllocateContainer(total_size, ContainerLength, Container);
         }
 
-        //元のデータを前に寄せる
-        int index_keep = 0;
-        if(export_ids.size()>0)
+        char*                dst = planar ? new char[total_size] : (char*)*Container;
+        std::vector<ssize_t> read_sizes(num_files, 0);
+#pragma omp parallel for schedule(dynamic) if(num_files > 1)
+        for(long i = 0; i < num_files; i++)
         {
-          std::sort(export_ids.begin(), export_ids.end());
-          std::vector<ZOLTAN_ID_TYPE>::iterator it=export_ids.begin();
-          for(int i = 0; i < *ContainerLength; i++)
-          {
-            if(i==*it)
+            if(readers[i] == NULL) continue;
+            size_t original_size;
+            if(sizes[i] == 0)
             {
-              ++it;
+                read_sizes[i] = 0;
+            }else if(filenames[i].partial){
+                read_sizes[i] = ReadRange(readers[i], filenames[i], container_info, original_sizes[i], dst+offsets[i]);
             }else{
-              (*Container)[index_keep++] = (*Container)[i];
+                read_sizes[i] = readers[i]->read_into(original_size, dst+offsets[i], sizes[i]);
             }
-          }
-        }else{
-          index_keep=*ContainerLength;
+            delete readers[i];
         }
-        pm_end("migrate_container: prepare to send");
-        pm_begin("migrate_container: call MPI_Send");
-        int dst_rank = 0;
-        int tag      = 0;
-        for(std::vector<std::vector<ZOLTAN_ID_TYPE>*>::const_iterator it = export_objs.begin(); it != export_objs.end(); ++it)
+
+        // 読み込みに失敗したファイルの分は詰める
+        size_t read_size = 0;
+        for(long i = 0; i < num_files; i++)
         {
-            int send_count = ((*it)->size())*nComp;
-            if(send_count > 0)
+            if(read_sizes[i] < 0)
             {
-                Send(send_buffs[dst_rank], send_count, dst_rank, tag++, wMetaData->GetComm());
+                std::cerr<<"failed to read field data ("<<name<<")"<<std::endl;
+                continue;
             }
-            dst_rank++;
+            if(read_size != offsets[i])
+            {
+                memmove(dst+read_size, dst+offsets[i], read_sizes[i]);
+            }
+            read_size += read_sizes[i];
         }
-        pm_end("migrate_container: call MPI_Send");
-        pm_begin("migrate_container: call MPI_Send 2");
-        MPI_Barrier(wMetaData->GetComm()); // 送信しないRankが通り抜けてしまうので、この位置でのBarrierは必須
-        pm_end("migrate_container: call MPI_Send 2");
-        pm_begin("migrate_container: unpack recieved data");
 
-        // 受信したデータ+転送しなかったデータのサイズで領域を確保
-        int room           = *ContainerLength-index_keep; // 送信データ数(=確保済領域の空きサイズを計算)
-        *ContainerLength   = index_keep;                  // ContainerLengthを未送信データ数で置き換える
-        int sum_recv_count = 0;
-        for(int i = 0; i < num_procs; i++)
+        // ファイル毎に[x..., y..., z...]の順で読み込んだデータを、成分毎に全ファイル分並べる
+        if(planar)
         {
-            sum_recv_count += recv_counts[i]*nComp;
-        }
-        if(room < sum_recv_count)
-        {
-            if(*Container == NULL)
+            if(read_size > 0)
             {
-                *Container = new T[index_keep+sum_recv_count];
-            }else{
-                //reallocate
-                T* tmp = *Container;
-                *Container = new T[index_keep+sum_recv_count];
-                for(int i = 0; i < index_keep; i++)
+                AllocateContainer(read_size, ContainerLength, Container);
+            }
+            const size_t num_particles = read_size/particle_size;
+            const char*  src           = dst;
+            size_t       particle      = 0;
+            for(long i = 0; i < num_files; i++)
+            {
+                if(read_sizes[i] <= 0) continue;
+                const size_t n = read_sizes[i]/particle_size;
+                for(int k = 0; k < container_info.nComp; k++)
                 {
-                    (*Container)[i] = tmp[i];
+                    memcpy((char*)*Container+(k*num_particles+particle)*element_size, src+k*n*element_size, n*element_size);
                 }
+                src      += read_sizes[i];
+                particle += n;
             }
+            delete[] dst;
         }
+        return read_size;
+    }
+
+    //! @brief 読み込むデータがファイル内に変換無しで連続して格納されている時は、ファイルをmmapする
+    //
+    //全ファイルのデータが同じファイル内で隙間無く並んでいて、先頭がsizeof(T)の境界にある時のみmmapする
+    //ファイルの一部だけを読む時と、IJKNのベクトルデータを複数のファイルから読む時はmmapしない
+    //! @param [in]  name       コンテナ名
+    //! @param [in]  filenames  読み込むファイルのリスト
+    //! @param [out] data       データの先頭
+    //! @param [out] length     データの要素数
+    //! @param [out] map_base   BaseIO::PosixIO::unmap_file()に渡す値
+    //! @param [out] map_size   BaseIO::PosixIO::unmap_file()に渡す値
+    //! @return mmapできなかった時はfalse
+    template<typename T>
+    bool MapFiles(const std::string& name, const std::vector<FieldFile>& filenames, const T** data, size_t* length, void** map_base, size_t* map_size)
+    {
+        ContainerInfo container_info;
+        rMetaData->GetContainerInfo(name, &container_info);
 
-        //受信バッファを元データの末尾に追加
-        int recieved_size= 0;
-        for(int src_rank = 0; src_rank < num_procs; src_rank++)
+        std::string filename;
+        size_t      begin = 0;
+        size_t      end   = 0;
+        bool        found = filenames.size() == 1 || container_info.nComp == 1 || container_info.VectorOrder == NIJK;
+        for(std::vector<FieldFile>::const_iterator it = filenames.begin(); it != filenames.end(); ++it)
         {
-          recieved_size+= recv_counts[src_rank]*nComp;
-          for(int i = 0; i < recv_counts[src_rank]*nComp; i++)
-          {
-            (*Container)[index_keep++] = recv_buffs[src_rank][i];
-          }
+            found = found && !(*it).partial;
         }
-        *ContainerLength += recieved_size;
-        pm_end("migrate_container: unpack recieved data");
-        pm_begin("migrate_container: post process");
+        for(std::vector<FieldFile>::const_iterator it = filenames.begin(); it != filenames.end() && found; ++it)
+        {
+            BaseIO::Read* reader = BaseIO::ReadFactory::create((*it).filename, container_info.Compression, enumType2string(container_info.Type), container_info.nComp, (*it).region, IOBackend);
+            size_t        original_size = 0;
+            std::string   extent_filename;
+            size_t        offset = 0;
+            size_t        size   = 0;
+            const int     rc     = reader->read_header(original_size);
+            found = rc == 0 || (rc > 0 && reader->get_raw_extent(extent_filename, offset, size));
+            delete reader;
+            if(rc == 0 || size == 0)
+            {
+                continue;
+            }
 
-        for(typename std::vector<T*>::iterator it = send_buffs.begin(); it != send_buffs.end(); ++it)
+            if(filename.empty() && offset%sizeof(T) == 0)
+            {
+                filename = extent_filename;
+                begin    = offset;
+                end      = offset+size;
+            }else if(extent_filename == filename && offset == end){
+                end += size;
+            }else{
+                found = false;
+            }
+        }
+        if(!found || filename.empty())
         {
-            delete[] *it;
+            return false;
         }
-        delete[] requests;
-        for(int i = 0; i < num_procs; i++)
+
+        const char* ptr = BaseIO::PosixIO::map_file(filename.c_str(), begin, end-begin, map_base, map_size);
+        if(ptr == NULL)
         {
-            delete[] recv_buffs[i];
+            return false;
         }
-        delete[] recv_buffs;
-        pm_end("migrate_container: post process");
+        *data   = (const T*)ptr;
+        *length = (end-begin)/sizeof(T);
+        return true;
     }
 
-    void migrate_container_selector(ContainerPointer* container, int* recv_counts, const std::vector<std::vector<ZOLTAN_ID_TYPE>*>& export_objs)
+    //! containerの型に合わせてReadFiles()を呼び出し、ユーザが登録したコンテナに直接読み込む
+    void read_container_selector(ContainerPointer* container, const std::vector<FieldFile>& filenames)
     {
         if((container)->Type == INT32)
         {
-            migrate_container((int**)&((container)->buff), &(container->ContainerLength), recv_counts, container->nComp, export_objs);
+            container->size = ReadFiles(container->Name, filenames, (int**)(container->Container), container->ContainerLength);
         }else if((container)->Type == uINT32){
-            migrate_container((unsigned int**)&((container)->buff), &(container->ContainerLength), recv_counts, container->nComp, export_objs);
+            container->size = ReadFiles(container->Name, filenames, (unsigned int**)(container->Container), container->ContainerLength);
         }else if((container)->Type == INT64){
-            migrate_container((long**)&((container)->buff), &(container->ContainerLength), recv_counts, container->nComp, export_objs);
+            container->size = ReadFiles(container->Name, filenames, (long**)(container->Container), container->ContainerLength);
         }else if((container)->Type == uINT64){
-            migrate_container((unsigned long**)&((container)->buff), &(container->ContainerLength), recv_counts, container->nComp, export_objs);
+            container->size = ReadFiles(container->Name, filenames, (unsigned long**)(container->Container), container->ContainerLength);
         }else if((container)->Type == FLOAT){
-            migrate_container((float**)&((container)->buff), &(container->ContainerLength), recv_counts, container->nComp, export_objs);
+            container->size = ReadFiles(container->Name, filenames, (float**)(container->Container), container->ContainerLength);
         }else if((container)->Type == DOUBLE){
-            migrate_container((double**)&((container)->buff), &(container->ContainerLength), recv_counts, container->nComp, export_objs);
+            container->size = ReadFiles(container->Name, filenames, (double**)(container->Container), container->ContainerLength);
+        }
+        container->ContainerLength = container->size/GetSize((container)->Type);
+    }
+
+    // Containerに領域を確保する
+    template<typename T>
+    void AllocateContainer(const size_t& total_size, const size_t& ContainerLength, T** Container)
+    {
+        size_t length = total_size/sizeof(T);
+        if(length > ContainerLength)
+        {
+            delete[] *Container;
+            *Container = NULL;
+        }
+        if(*Container == NULL)
+        {
+            *Container = new T[length];
+        }
+    }
+
+    //! bufferの内容をContainerが指す領域にコピーする
+    template<typename T>
+    size_t CopyBufferToContainer(T* Container, const char* buffer, const size_t& size)
+    {
+        size_t length = size/sizeof(T);
+        memcpy(Container, buffer, length*sizeof(T));
+        return length;
+    }
+
+    //! objsで指定された粒子をdstに詰めて、次のコンテナのデータを詰める位置を返す
+    template<typename T>
+    char* pack_container(const ContainerPointer* container, const std::vector<ZOLTAN_ID_TYPE>& objs, const size_t& num_particles, char* dst)
+    {
+        return PackParticles((const T*)container->buff, num_particles, container->nComp, container->NIJK_Flag, objs, dst);
+    }
+
+    char* pack_container_selector(const ContainerPointer* container, const std::vector<ZOLTAN_ID_TYPE>& objs, const size_t& num_particles, char* dst)
+    {
+        if(container->Type == INT32)
+        {
+            return pack_container<int>(container, objs, num_particles, dst);
+        }else if(container->Type == uINT32){
+            return pack_container<unsigned int>(container, objs, num_particles, dst);
+        }else if(container->Type == INT64){
+            return pack_container<long>(container, objs, num_particles, dst);
+        }else if(container->Type == uINT64){
+            return pack_container<unsigned long>(container, objs, num_particles, dst);
+        }else if(container->Type == FLOAT){
+            return pack_container<float>(container, objs, num_particles, dst);
+        }else if(container->Type == DOUBLE){
+            return pack_container<double>(container, objs, num_particles, dst);
+        }
+        return dst;
+    }
+
+    //! @brief keptの粒子を前に詰め、受信した粒子を末尾に追加する
+    //
+    //粒子数が増える時はcontainer->buffを確保し直す
+    template<typename T>
+    void unpack_container(ContainerPointer* container, const std::vector<size_t>& kept, const size_t& num_recv, const MessageMap& recv_buffs, std::map<int, size_t>* positions, std::vector<char>* scratch)
+    {
+        const size_t nComp         = container->nComp;
+        const size_t num_particles = container->ContainerLength/nComp;
+        container->buff            = (char*)UnpackParticles((T*)container->buff, num_particles, nComp, container->NIJK_Flag, kept, num_recv, recv_buffs, positions, scratch);
+        container->ContainerLength = (kept.size()+num_recv)*nComp;
+        container->size            = container->ContainerLength*sizeof(T);
+    }
+
+    void unpack_container_selector(ContainerPointer* container, const std::vector<size_t>& kept, const size_t& num_recv, const MessageMap& recv_buffs, std::map<int, size_t>* positions, std::vector<char>* scratch)
+    {
+        if(container->Type == INT32)
+        {
+            unpack_container<int>(container, kept, num_recv, recv_buffs, positions, scratch);
+        }else if(container->Type == uINT32){
+            unpack_container<unsigned int>(container, kept, num_recv, recv_buffs, positions, scratch);
+        }else if(container->Type == INT64){
+            unpack_container<long>(container, kept, num_recv, recv_buffs, positions, scratch);
+        }else if(container->Type == uINT64){
+            unpack_container<unsigned long>(container, kept, num_recv, recv_buffs, positions, scratch);
+        }else if(container->Type == FLOAT){
+            unpack_container<float>(container, kept, num_recv, recv_buffs, positions, scratch);
+        }else if(container->Type == DOUBLE){
+            unpack_container<double>(container, kept, num_recv, recv_buffs, positions, scratch);
         }
-        container->size = (container->ContainerLength)*GetSize((container)->Type);
+    }
+
+    //! @brief LB_Partitionの結果に従って、全コンテナの粒子を1回の通信で交換する
+    //
+    //送信先毎に全コンテナのデータを1つのメッセージに詰め、SparseExchange()で送受信する
+    //メモリと時間は実際に粒子をやりとりする相手の数にだけ比例する
+    //メッセージの形式はMigrationKernel.hを参照
+    //@param [in] export_objs 送信先Rank毎の送信する粒子のlocal id
+    void ExchangeParticles(const std::map<int, std::vector<ZOLTAN_ID_TYPE> >& export_objs)
+    {
+        pm_begin("Migrate: pack");
+        const size_t num_particles = CoordinateContainer->ContainerLength/CoordinateContainer->nComp;
+
+        MessageMap        send_buffs;
+        std::vector<char> exported(num_particles, 0);
+        for(std::map<int, std::vector<ZOLTAN_ID_TYPE> >::const_iterator it = export_objs.begin(); it != export_objs.end(); ++it)
+        {
+            const uint64_t num_objs = it->second.size();
+            size_t         size     = sizeof(uint64_t);
+            for(std::vector<ContainerPointer*>::iterator container = ContainerTable.begin(); container != ContainerTable.end(); ++container)
+            {
+                size += AlignedSize(num_objs*(*container)->nComp*GetSize((*container)->Type));
+            }
+            std::vector<char>& buff = send_buffs[it->first];
+            buff.resize(size, 0);
+            memcpy(&(buff[0]), &num_objs, sizeof(uint64_t));
+            char* dst = &(buff[sizeof(uint64_t)]);
+            for(std::vector<ContainerPointer*>::iterator container = ContainerTable.begin(); container != ContainerTable.end(); ++container)
+            {
+                dst = pack_container_selector(*container, it->second, num_particles, dst);
+            }
+            for(std::vector<ZOLTAN_ID_TYPE>::const_iterator id = it->second.begin(); id != it->second.end(); ++id)
+            {
+                exported[*id] = 1;
+            }
+        }
+        pm_end("Migrate: pack");
+        pm_begin("Migrate: exchange");
+
+        MessageMap recv_buffs;
+        SparseExchange(send_buffs, &recv_buffs, wMetaData->GetComm(), MigrationTag);
+        send_buffs.clear();
+        pm_end("Migrate: exchange");
+        pm_begin("Migrate: unpack");
+
+        // 残す粒子の番号の一覧は全コンテナで共通
+        std::vector<size_t> kept;
+        MakeKeepList(exported, &kept);
+
+        size_t                num_recv = 0;
+        std::map<int, size_t> positions;
+        for(MessageMap::const_iterator it = recv_buffs.begin(); it != recv_buffs.end(); ++it)
+        {
+            num_recv            += *(const uint64_t*)&(it->second[0]);
+            positions[it->first] = sizeof(uint64_t);
+        }
+        std::vector<char> scratch;
+        for(std::vector<ContainerPointer*>::iterator it = ContainerTable.begin(); it != ContainerTable.end(); ++it)
+        {
+            unpack_container_selector(*it, kept, num_recv, recv_buffs, &positions, &scratch);
+        }
+        pm_end("Migrate: unpack");
     }
 
     void Set_Geom_Multi_Fn(Zoltan* zz)
@@ -573,28 +1229,39 @@ public:
         }
     }
 
-    bool Migrate()
+    //! @brief 再分割に使うZoltanオブジェクトを返す
+    //
+    //最初の呼び出し時に生成し、以降はカットの情報を保持したまま使い回す
+    Zoltan* GetLoadBalancer(void)
     {
-        pm_begin("Migrate: setup Zoltan");
-        MPI_Comm comm = wMetaData->GetComm();
-        Zoltan*  zz   = new Zoltan(comm);
-        if(zz == NULL)
+        if(LoadBalancer != NULL) return LoadBalancer;
+
+        LoadBalancer = new Zoltan(wMetaData->GetComm());
+        LoadBalancer->Set_Param("NUM_GID_ENTRIES", "2");  //global id としてunsigned integer 2つを使用する
+        LoadBalancer->Set_Param("NUM_LID_ENTRIES", "1");  //local id としてunsigned integer 1つを使用する (default)
+        LoadBalancer->Set_Param("DEBUG_LEVEL",     "0");  //debug level default値は1
+        LoadBalancer->Set_Param("OBJ_WEIGHT_DIM",  "0");  //ロードバランス計算時にオブジェクトの重みをつけない (default)
+        LoadBalancer->Set_Param("RETURN_LISTS",    "EXPORT"); // export listだけを返す（import listを作るための通信を省く）
+        for(std::map<std::string, std::string>::iterator it = LoadBalanceParams.begin(); it != LoadBalanceParams.end(); ++it)
         {
-            std::cerr<<"create zoltan object failed!"<<std::endl;
-            return false;
+            LoadBalancer->Set_Param(it->first.c_str(), it->second.c_str());
         }
+        return LoadBalancer;
+    }
 
-        // parameter setting
-        zz->Set_Param("NUM_GID_ENTRIES", "2");  //global id としてunsigned integer 2つを使用する
-        zz->Set_Param("NUM_LID_ENTRIES", "1");  //local id としてunsigned integer 1つを使用する (default)
-        zz->Set_Param("DEBUG_LEVEL",     "0");  //debug level default値は1
-        zz->Set_Param("OBJ_WEIGHT_DIM",  "0");  //ロードバランス計算時にオブジェクトの重みをつけない (default)
-
-        zz->Set_Param("LB_METHOD",       "RCB"); // パーティショニングのアルゴリズム (default)
-        zz->Set_Param("RETURN_LISTS",    "ALL"); // import listとexport listの両方を返す (default)
-        zz->Set_Param("IMBALANCE_TOL",   "1.1"); // 110%以下のインバランスは許容する (default)
+    //! @brief CoordinateContainerの座標を元に、全コンテナのContainerPointer::buffの内容を再分割する
+    //
+    //前回の呼び出しと同じZoltanオブジェクトを使うので、RCBのカットは前回の結果から更新される
+    //! @param [out] changed  NULLでなければ、粒子の移動があったかどうかを返す
+    bool Migrate(bool* changed = NULL)
+    {
+        if(changed != NULL) *changed = false;
+        pm_begin("Migrate: setup Zoltan");
+        MPI_Comm comm = wMetaData->GetComm();
+        Zoltan*  zz   = GetLoadBalancer();
 
         // register query functions
+        // buffは呼び出し毎に異なるので、query関数は毎回登録し直す
         zz->Set_Num_Obj_Fn(get_num_object, CoordinateContainer->buff);
         zz->Set_Obj_List_Fn(get_object_list, CoordinateContainer->buff);
         zz->Set_Num_Geom_Fn(get_num_geometry, CoordinateContainer->buff);
@@ -604,15 +1271,15 @@ public:
         int numGidEntries;
         int numLidEntries;
         int numImport;
-        ZOLTAN_ID_PTR importGlobalIds;
-        ZOLTAN_ID_PTR importLocalIds;
-        int*          importProcs;
-        int*          importToPart;
+        ZOLTAN_ID_PTR importGlobalIds = NULL;
+        ZOLTAN_ID_PTR importLocalIds  = NULL;
+        int*          importProcs     = NULL;
+        int*          importToPart    = NULL;
         int numExport;
-        ZOLTAN_ID_PTR exportGlobalIds;
-        ZOLTAN_ID_PTR exportLocalIds;
-        int*          exportProcs;
-        int*          exportToPart;
+        ZOLTAN_ID_PTR exportGlobalIds = NULL;
+        ZOLTAN_ID_PTR exportLocalIds  = NULL;
+        int*          exportProcs     = NULL;
+        int*          exportToPart    = NULL;
 
         pm_end("Migrate: setup Zoltan");
         pm_begin("Migrate: Zoltan::LB_Partition");
@@ -628,54 +1295,37 @@ public:
         if(max_rc != ZOLTAN_OK || min_rc != ZOLTAN_OK)
         {
             std::cerr<<"Zoltan LB_Partition failed!"<<std::endl;
+            Zoltan::LB_Free_Part(&importGlobalIds, &importLocalIds, &importProcs, &importToPart);
+            Zoltan::LB_Free_Part(&exportGlobalIds, &exportLocalIds, &exportProcs, &exportToPart);
+            pm_end("Migrate: check return code of Zoltan::LB_Partition");
             return false;
         }
         pm_end("Migrate: check return code of Zoltan::LB_Partition");
-        pm_begin("Migrate: prepare to receive");
 
-        // LB_Partitionの結果を元に相手プロセス毎の受信オブジェクト数リストを作成
-        const int num_procs   = wMetaData->GetNumProc();
-        int*      recv_counts = new int[num_procs];
-        for(int i = 0; i < num_procs; i++)
+        // 分割結果がどのRankでも変わらなければ移動する粒子は無い
+        if(!changes)
         {
-            recv_counts[i] = 0;
+            Zoltan::LB_Free_Part(&importGlobalIds, &importLocalIds, &importProcs, &importToPart);
+            Zoltan::LB_Free_Part(&exportGlobalIds, &exportLocalIds, &exportProcs, &exportToPart);
+            return true;
         }
-        for(int i = 0; i < numImport; i++)
-        {
-            ++(recv_counts[importProcs[i]]);
-        }
-        pm_end("Migrate: prepare to receive");
         pm_begin("Migrate: prepare to send");
 
-        // LB_Partitionの結果を元に相手プロセス毎の送信オブジェクトのリストを作成
-        // 本当は外側のvectorはarrayで十分だがC++11非対応の環境向けにvectorにしている
-        std::vector<std::vector<ZOLTAN_ID_TYPE>*> export_objs(num_procs);
-        for(int i = 0; i < num_procs; i++)
-        {
-            export_objs[i] = new std::vector<ZOLTAN_ID_TYPE>;
-        }
+        // LB_Partitionの結果を元に、実際に送信する相手毎の送信オブジェクトのリストを作成
+        // 受信側は相手も粒子数もExchangeParticles()の中で知るので、import listは使わない
+        std::map<int, std::vector<ZOLTAN_ID_TYPE> > export_objs;
         for(int i = 0; i < numExport; i++)
         {
-            (export_objs[exportProcs[i]])->push_back(exportLocalIds[i]);
+            export_objs[exportProcs[i]].push_back(exportLocalIds[i]);
         }
 
         Zoltan::LB_Free_Part(&importGlobalIds, &importLocalIds, &importProcs, &importToPart);
         Zoltan::LB_Free_Part(&exportGlobalIds, &exportLocalIds, &exportProcs, &exportToPart);
         pm_end("Migrate: prepare to send");
-        pm_begin("Migrate: do migration");
 
-        // コンテナ毎にマイグレーションを実行
-        for(std::vector<ContainerPointer*>::iterator it = ContainerTable.begin(); it != ContainerTable.end(); ++it)
-        {
-            migrate_container_selector(*it, recv_counts, export_objs);
-        }
-        delete[] recv_counts;
-        for(std::vector<std::vector<ZOLTAN_ID_TYPE>*>::iterator it = export_objs.begin(); it != export_objs.end(); ++it)
-        {
-            delete *it;
-        }
-        delete zz;
-        pm_end("Migrate: do migration");
+        // 全コンテナをまとめて1回で交換する
+        ExchangeParticles(export_objs);
+        if(changed != NULL) *changed = true;
         return true;
     }
 
@@ -849,13 +1499,39 @@ public:
 
     static ContainerPointer* CoordinateContainer;   //< 座標情報を保存したコンテナ
     static int static_my_rank;                      //< 自Rankのランク番号
+    static const int MigrationTag;                  //< マイグレーションの粒子の送受信に使うtag
     std::vector<ContainerPointer*> ContainerTable;  //< RegisterContainer()で渡されたポインタを登録するテーブル
     int BufferSize;                                 //< ファイル出力バッファのサイズ 単位はMiB
     int MaxBufferingTime;                           //< ファイル出力をバッファリングする回数
+    int KeyFrameInterval;                           //< temporal符号化でキーフレームを出力する間隔
+    bool AutoMinMax;                                //< MinMaxが渡されなかった時にWrite()内で計算するかどうかのフラグ
+    bool GlobalTimeSlice;                           //< Write()内で粒子数とMinMaxを全Rank分集約するかどうかのフラグ
+    bool BalancedRead;                              //< 粒子数が均等になるように読み込むファイルと範囲を決めるかどうかのフラグ
+    std::string IOBackend;                          //< Rank毎のファイルの入出力方法（"stream", "posix", "direct")
+    Zoltan* LoadBalancer;                           //< Migrate()で使い回すZoltanオブジェクト
+    std::map<std::string, std::string> LoadBalanceParams; //< LoadBalancerに設定するZoltanのパラメータ
+    std::vector<BufferedOutput> OutputBuffer;       //< ファイル出力待ちのデータ
+    std::map<std::string, EncodePipeline> Pipelines;//< コンテナ毎のエンコーダチェーン
+    std::set<int> BufferedSteps;                    //< OutputBufferに含まれるタイムステップ
+    size_t BufferedBytes;                           //< OutputBuffer内のデータ量（Byte)
+    bool AsyncWrite;                                //< 非同期出力を行うかどうかのフラグ
+    bool AsyncWriteRequested;                       //< SetAsyncWrite()で指定された値（I/Oスレッドを起動できずに同期出力に切り替えた後も変わらない）
+    bool IOThreadRunning;                           //< I/Oスレッドが起動済かどうかのフラグ
+    bool IOThreadStop;                              //< I/Oスレッドに終了を指示するフラグ
+    pthread_t IOThread;                             //< 非同期出力を行うI/Oスレッド
+    pthread_mutex_t JobMutex;                       //< JobQueue, InFlight, NumPendingJobsを保護するmutex
+    pthread_cond_t JobQueued;                       //< JobQueueにジョブが追加されたことを通知する条件変数
+    pthread_cond_t JobDone;                         //< ジョブが完了したことを通知する条件変数
+    std::deque<WriteJob> JobQueue;                  //< I/Oスレッドが処理するジョブのキュー
+    std::map<std::string, int> InFlight;            //< コンテナ毎の未完了のジョブ数
+    int NumPendingJobs;                             //< 全コンテナの未完了のジョブ数
     std::string ReadDFI_FileName;                   //< 読み出すDFIファイルの名前
     std::string WriteDFI_FileName;                  //< 書きみ出すDFIファイルの名前
     bool Initialized;                               //< 初期化済を示すフラグ
     bool FirstCall;                                 //< Writeの呼び出しが1回目か2回目以降かを示すフラグ
+    int LastDirectoryStep;                          //< sharded構成で出力先ディレクトリを作成済のタイムステップ
+    MPI_Comm DirectoryComm;                         //< sharded構成で同じディレクトリに出力するRankのコミュニケータ
+    MPI_Comm DirectoryNodeComm;                     //< DirectoryCommを同じノード上のRank毎に分割したコミュニケータ
     MetaData* rMetaData;                            //< ファイル入力用のメタデータオブジェクトへのポインタ
     MetaData* wMetaData;                            //< ファイル出力用のメタデータオブジェクトへのポインタ
     bool PM;                                        //< 計時機能を有効にするかどうかのフラグ
@@ -866,5 +1542,6 @@ public:
 
 ContainerPointer* PDMlib::Impl::CoordinateContainer;
 int PDMlib::Impl::static_my_rank;
+const int PDMlib::Impl::MigrationTag = 32001;
 } //end of namespace
 #endif
@@ -0,0 +1,251 @@
+/*
+###################################################################################
+#
+# PDMlib - Particle Data Management library
+#
+# Copyright (c) 2014-2017 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2017 Research Institute for Information Technology (RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+*/
+
+#ifndef PDMLIB_POSIX_IO_H
+#define PDMLIB_POSIX_IO_H
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+
+//! WritePosixFile, ReadPosixFile, PDMlib::ReadView()で使うPOSIX I/Oのヘルパー関数
+//
+//libstdc++のストリームバッファを経由せずに、ユーザ領域とカーネルの間で直接データを転送する
+//O_DIRECTを使う時は、アライメントを揃えたbounce bufferを経由して読み書きする
+namespace BaseIO
+{
+namespace PosixIO
+{
+//! O_DIRECTで読み書きする時のバッファ、オフセット、サイズのアライメント（Byte)
+const size_t alignment = 4096;
+
+//! O_DIRECTで読み書きする時のbounce bufferのサイズ（Byte)
+const size_t bounce_size = 8*1024*1024;
+
+//! O_DIRECTを使う最小のデータサイズ（Byte)  これより小さいファイルはページキャッシュを経由する
+const size_t direct_threshold = 64*1024*1024;
+
+//! alignment Byte境界に揃えた領域を確保する  解放はfree()で行うこと
+inline char* allocate_aligned(const size_t& size)
+{
+    void* ptr = NULL;
+    if(posix_memalign(&ptr, alignment, size) != 0) return NULL;
+    return (char*)ptr;
+}
+
+//! directがtrueの時はO_DIRECTを付けてファイルを開く
+//
+//O_DIRECTが定義されていない処理系や、O_DIRECTに対応していないファイルシステムでは、O_DIRECT無しで開く
+inline int open_file(const char* filename, int flags, const bool& direct)
+{
+#ifdef O_DIRECT
+    if(direct)
+    {
+        const int fd = ::open(filename, flags|O_DIRECT, 0644);
+        if(fd >= 0 || errno != EINVAL) return fd;
+    }
+#endif
+    return ::open(filename, flags, 0644);
+}
+
+//! fdがO_DIRECTで開かれているかどうか
+inline bool is_direct(const int& fd)
+{
+#ifdef O_DIRECT
+    const int flags = fcntl(fd, F_GETFL);
+    return flags != -1 && (flags&O_DIRECT) != 0;
+#else
+    return false;
+#endif
+}
+
+//! ファイル全体を先頭から順に読む予定であることをカーネルに通知する
+inline void advise_sequential(const int& fd)
+{
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
+//! iovの内容を全て書き込む  途中までしか書き込めなかった時は残りを書き込み直す
+//
+//iovの内容は書き換えられる
+inline bool writev_all(const int& fd, struct iovec* iov, int iovcnt)
+{
+    while(iovcnt > 0)
+    {
+        const ssize_t n = ::writev(fd, iov, iovcnt);
+        if(n < 0)
+        {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        size_t written = n;
+        while(iovcnt > 0 && written >= iov->iov_len)
+        {
+            written -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if(iovcnt > 0)
+        {
+            iov->iov_base = (char*)iov->iov_base+written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+//! srcからsize Byteをファイルのoffsetの位置に書き込む
+inline bool pwrite_all(const int& fd, const char* src, size_t size, off_t offset)
+{
+    while(size > 0)
+    {
+        const ssize_t n = ::pwrite(fd, src, size, offset);
+        if(n < 0)
+        {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        src    += n;
+        size   -= n;
+        offset += n;
+    }
+    return true;
+}
+
+//! ファイルのoffsetの位置からsize Byteをdstに読み込む
+inline bool pread_all(const int& fd, char* dst, size_t size, off_t offset)
+{
+    while(size > 0)
+    {
+        const ssize_t n = ::pread(fd, dst, size, offset);
+        if(n < 0)
+        {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        if(n == 0) return false;
+        dst    += n;
+        size   -= n;
+        offset += n;
+    }
+    return true;
+}
+
+//! O_DIRECTで開いたファイルに、headerとdataを続けて先頭から書き込む
+//
+//bounce bufferに詰めてalignment単位で書き込み、最後のブロックの余りはftruncateで切り詰める
+inline bool write_direct(const int& fd, const char* header, const size_t& header_size, const char* data, const size_t& size)
+{
+    char* bounce = allocate_aligned(bounce_size);
+    if(bounce == NULL) return false;
+
+    bool   ok       = true;
+    off_t  offset   = 0;
+    size_t consumed = 0;
+    memcpy(bounce, header, header_size);
+    size_t filled = header_size;
+    for(;;)
+    {
+        const size_t length = std::min(bounce_size-filled, size-consumed);
+        memcpy(bounce+filled, data+consumed, length);
+        filled   += length;
+        consumed += length;
+
+        const size_t write_size = (filled+alignment-1)/alignment*alignment;
+        memset(bounce+filled, 0, write_size-filled);
+        if(!pwrite_all(fd, bounce, write_size, offset))
+        {
+            ok = false;
+            break;
+        }
+        offset += filled;
+        filled  = 0;
+        if(consumed == size) break;
+    }
+    free(bounce);
+    return ok && ftruncate(fd, offset) == 0;
+}
+
+//! O_DIRECTで開いたファイルのoffsetの位置からsize Byteをdstに読み込む
+//
+//alignment境界から始まるブロックをbounce bufferに読み込んで、必要な部分をdstにコピーする
+//bounce bufferは読み込む範囲をalignment単位に広げたサイズ（最大bounce_size）だけ確保する
+inline bool pread_direct(const int& fd, char* dst, size_t size, off_t offset)
+{
+    if(size == 0) return true;
+    const size_t request   = (offset%alignment+size+alignment-1)/alignment*alignment;
+    const size_t buff_size = std::min(bounce_size, request);
+    char*        bounce    = allocate_aligned(buff_size);
+    if(bounce == NULL) return false;
+
+    bool ok = true;
+    while(size > 0)
+    {
+        const off_t   begin = offset/alignment*alignment;
+        const size_t  skip  = offset-begin;
+        const ssize_t n     = ::pread(fd, bounce, buff_size, begin);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= (ssize_t)skip)
+        {
+            ok = false;
+            break;
+        }
+        const size_t length = std::min(size, (size_t)n-skip);
+        memcpy(dst, bounce+skip, length);
+        dst    += length;
+        size   -= length;
+        offset += length;
+    }
+    free(bounce);
+    return ok;
+}
+//! filenameのoffsetの位置からsize Byteを読み込み専用でメモリにマップする
+//
+//mmapするファイル上の位置はページ境界に揃える必要があるので、offsetを含むページの先頭からマップする
+//! @param [out] map_base  unmap_file()に渡すマップ領域の先頭
+//! @param [out] map_size  unmap_file()に渡すマップ領域の大きさ
+//! @return offsetの位置に対応するアドレス  マップできなかった時はNULL
+inline const char* map_file(const char* filename, const size_t& offset, const size_t& size, void** map_base, size_t* map_size)
+{
+    const int fd = ::open(filename, O_RDONLY);
+    if(fd < 0) return NULL;
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    const size_t begin     = offset/page_size*page_size;
+    *map_size = offset-begin+size;
+    void* ptr = mmap(NULL, *map_size, PROT_READ, MAP_PRIVATE, fd, begin);
+    close(fd);
+    if(ptr == MAP_FAILED) return NULL;
+#ifdef MADV_SEQUENTIAL
+    madvise(ptr, *map_size, MADV_SEQUENTIAL);
+#endif
+    *map_base = ptr;
+    return (const char*)ptr+(offset-begin);
+}
+
+//! map_file()でマップした領域を解放する
+inline void unmap_file(void* map_base, const size_t& map_size)
+{
+    munmap(map_base, map_size);
+}
+} //end of namespace PosixIO
+} //end of namespace BaseIO
+#endif
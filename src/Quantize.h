@@ -0,0 +1,297 @@
+/*
+###################################################################################
+#
+# PDMlib - Particle Data Management library
+#
+# Copyright (c) 2014-2017 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2017 Research Institute for Information Technology (RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+*/
+
+#ifndef PDMLIB_QUANTIZE_H
+#define PDMLIB_QUANTIZE_H
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <stdint.h>
+#include "Shuffle.h"
+
+//! FLOAT/DOUBLE型コンテナ用の誤差保証付き非可逆量子化の実装
+//
+//データの最小値をmin、量子化幅をstepとして、各要素をq = round((x-min)/step)の整数に変換する
+//復元値 min+q*step と元の値の差はstep/2(+丸め誤差)以下になるように、stepには許容誤差をそのまま使う
+//qは全要素を表現できる最小のByte数(1,2,4,8)で格納し、後段の圧縮が効きやすいようにByte毎に並べ替える
+//
+//出力形式
+//  char     magic[4]        "PDMQ"
+//  uint8    size_of_type    要素のサイズ（4 or 8)
+//  uint8    width           qのByte数  0の時は量子化せずにそのまま格納している
+//  uint8    big_endian      出力したプロセスがビッグエンディアンなら1
+//  uint8    reserved
+//  uint64   raw_size        量子化前のデータサイズ(リトルエンディアン)
+//  double   min             (リトルエンディアン)
+//  double   step            (リトルエンディアン)
+//  char     q[]
+namespace BaseIO
+{
+namespace Quantize
+{
+const char   magic[4]    = {'P', 'D', 'M', 'Q'};
+const size_t header_size = 32;
+
+inline bool is_big_endian(void)
+{
+    const uint16_t one = 1;
+    return *(const char*)&one == 0;
+}
+
+//! n個のsize Byteの要素のバイトオーダを反転する
+inline void swap_bytes(char* data, const size_t& num_elements, const size_t& size)
+{
+    for(size_t i = 0; i < num_elements; i++)
+    {
+        std::reverse(data+i*size, data+(i+1)*size);
+    }
+}
+
+inline void put_le(char* dst, uint64_t value)
+{
+    for(int i = 0; i < 8; i++)
+    {
+        dst[i] = (char)(value&0xff);
+        value >>= 8;
+    }
+}
+
+inline uint64_t get_le(const char* src)
+{
+    uint64_t value = 0;
+    for(int i = 7; i >= 0; i--)
+    {
+        value = (value<<8)|(unsigned char)src[i];
+    }
+    return value;
+}
+
+inline void put_double(char* dst, const double& value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put_le(dst, bits);
+}
+
+inline double get_double(const char* src)
+{
+    const uint64_t bits = get_le(src);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+//! size Byteのデータを符号化した時の最大サイズ
+inline size_t bound(const size_t& size)
+{
+    return header_size+size;
+}
+
+template<typename T>
+bool min_max(const char* src, const size_t& num_elements, double* min, double* max)
+{
+    const T* data    = reinterpret_cast<const T*>(src);
+    T        tmp_min = num_elements > 0 ? data[0] : 0;
+    T        tmp_max = tmp_min;
+    bool     finite  = true;
+    for(size_t i = 0; i < num_elements; i++)
+    {
+        if(data[i] != data[i] || data[i]-data[i] != 0) finite = false;
+        tmp_min = std::min(tmp_min, data[i]);
+        tmp_max = std::max(tmp_max, data[i]);
+    }
+    *min = tmp_min;
+    *max = tmp_max;
+    return finite;
+}
+
+template<typename T, typename Q>
+void quantize(const char* src, const size_t& num_elements, const double& min, const double& step, char* dst)
+{
+    const T* data = reinterpret_cast<const T*>(src);
+    Q*       q    = reinterpret_cast<Q*>(dst);
+    const long n  = num_elements;
+#pragma omp parallel for schedule(static)
+    for(long i = 0; i < n; i++)
+    {
+        q[i] = (Q)std::floor((data[i]-min)/step+0.5);
+    }
+}
+
+template<typename T, typename Q>
+void dequantize(const char* src, const size_t& num_elements, const double& min, const double& step, char* dst)
+{
+    const Q* q    = reinterpret_cast<const Q*>(src);
+    T*       data = reinterpret_cast<T*>(dst);
+    const long n  = num_elements;
+#pragma omp parallel for schedule(static)
+    for(long i = 0; i < n; i++)
+    {
+        data[i] = (T)(min+q[i]*step);
+    }
+}
+
+template<typename T>
+void quantize(const char* src, const size_t& num_elements, const double& min, const double& step, const int& width, char* dst)
+{
+    switch(width)
+    {
+    case 1:
+        quantize<T, uint8_t>(src, num_elements, min, step, dst);
+        break;
+    case 2:
+        quantize<T, uint16_t>(src, num_elements, min, step, dst);
+        break;
+    case 4:
+        quantize<T, uint32_t>(src, num_elements, min, step, dst);
+        break;
+    default:
+        quantize<T, uint64_t>(src, num_elements, min, step, dst);
+        break;
+    }
+}
+
+template<typename T>
+void dequantize(const char* src, const size_t& num_elements, const double& min, const double& step, const int& width, char* dst)
+{
+    switch(width)
+    {
+    case 1:
+        dequantize<T, uint8_t>(src, num_elements, min, step, dst);
+        break;
+    case 2:
+        dequantize<T, uint16_t>(src, num_elements, min, step, dst);
+        break;
+    case 4:
+        dequantize<T, uint32_t>(src, num_elements, min, step, dst);
+        break;
+    default:
+        dequantize<T, uint64_t>(src, num_elements, min, step, dst);
+        break;
+    }
+}
+
+//! srcを量子化してdstに出力する
+//! @param [in] tolerance  許容誤差
+//! @param [in] relative   trueの時はtoleranceを(最大値-最小値)に対する比として扱う
+//! @param [in] work       size Byteの作業領域
+//! @return 出力サイズ
+inline size_t encode(const char* src, const size_t& size, char* dst, char* work, const size_t& size_of_type, const double& tolerance, const bool& relative)
+{
+    const size_t num_elements = size/size_of_type;
+    double       min          = 0.0;
+    double       max          = 0.0;
+    const bool   finite       = size_of_type == 8 ? min_max<double>(src, num_elements, &min, &max) : min_max<float>(src, num_elements, &min, &max);
+
+    double step = relative ? tolerance*(max-min) : tolerance;
+    if(max == min) step = 1.0;
+
+    // 量子化後の値の範囲から、qの格納に必要なByte数を決める
+    // 非数を含む場合、許容誤差が不正な場合、64bitで表せない場合は量子化しない
+    int width = 0;
+    if(finite && step > 0.0 && size%size_of_type == 0)
+    {
+        const double q_max = std::floor((max-min)/step+0.5);
+        if(q_max < 256.0)
+        {
+            width = 1;
+        }else if(q_max < 65536.0){
+            width = 2;
+        }else if(q_max < 4294967296.0){
+            width = 4;
+        }else if(q_max < 9007199254740992.0){
+            width = 8;
+        }
+    }
+    if(width > 0 && (size_t)width >= size_of_type) width = 0;
+
+    memcpy(dst, magic, sizeof(magic));
+    dst[4] = (char)size_of_type;
+    dst[5] = (char)width;
+    dst[6] = is_big_endian() ? 1 : 0;
+    dst[7] = 0;
+    put_le(dst+8, size);
+    put_double(dst+16, min);
+    put_double(dst+24, step);
+    if(width == 0)
+    {
+        memcpy(dst+header_size, src, size);
+        return header_size+size;
+    }
+
+    if(size_of_type == 8)
+    {
+        quantize<double>(src, num_elements, min, step, width, work);
+    }else{
+        quantize<float>(src, num_elements, min, step, width, work);
+    }
+    Shuffle::shuffle(work, dst+header_size, num_elements*width, width);
+    return header_size+num_elements*width;
+}
+
+//! srcが量子化されたデータかどうかを判定する
+inline bool is_encoded(const char* src, const size_t& src_size)
+{
+    return src_size >= header_size && memcmp(src, magic, sizeof(magic)) == 0;
+}
+
+//! 量子化前のデータサイズを返す
+inline size_t raw_size(const char* src)
+{
+    return get_le(src+8);
+}
+
+//! srcを復元してdstに出力する  dstとworkにはraw_size() Byteの領域を渡すこと
+//
+//出力したプロセスとエンディアンが異なる時は、後段のConvertEndianで変換できるように
+//出力したプロセスのバイトオーダで返す
+inline bool decode(const char* src, const size_t& src_size, char* dst, char* work)
+{
+    const size_t size_of_type = (unsigned char)src[4];
+    const size_t width        = (unsigned char)src[5];
+    const bool   big_endian   = src[6] != 0;
+    const size_t size         = raw_size(src);
+    const double min          = get_double(src+16);
+    const double step         = get_double(src+24);
+    if(size_of_type != 4 && size_of_type != 8) return false;
+
+    if(width == 0)
+    {
+        if(header_size+size != src_size) return false;
+        memcpy(dst, src+header_size, size);
+        return true;
+    }
+
+    const size_t num_elements = size/size_of_type;
+    if(header_size+num_elements*width != src_size) return false;
+    Shuffle::unshuffle(src+header_size, work, num_elements*width, width);
+    if(big_endian != is_big_endian())
+    {
+        swap_bytes(work, num_elements, width);
+    }
+    if(size_of_type == 8)
+    {
+        dequantize<double>(work, num_elements, min, step, width, dst);
+    }else{
+        dequantize<float>(work, num_elements, min, step, width, dst);
+    }
+    if(big_endian != is_big_endian())
+    {
+        swap_bytes(dst, num_elements, size_of_type);
+    }
+    return true;
+}
+} //end of namespace Quantize
+} //end of namespace BaseIO
+#endif
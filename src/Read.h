@@ -17,6 +17,7 @@
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <sys/types.h>
 #include "BOM.h"
 
 namespace BaseIO
@@ -32,8 +33,8 @@ class Read
     Read& operator=(const Read&);
 
 protected:
-    Read(){}
-    Read(const std::string& arg_filename, const size_t& arg_size_of_datatype):filename(arg_filename), size_of_datatype(arg_size_of_datatype) {}
+    Read(): header_loaded(false), byte_order_mark(0) {}
+    Read(const std::string& arg_filename, const size_t& arg_size_of_datatype):filename(arg_filename), size_of_datatype(arg_size_of_datatype), header_loaded(false), byte_order_mark(0) {}
 
 public:
     virtual ~Read(){}
@@ -44,14 +45,50 @@ public:
     //! @return -1: エラーによりデータが読めなかった
     //! @return  0: 指定されたファイルが存在しなかった
     //! @return >0: 実際に読み込んだデータサイズ(単位はByte)
-    virtual int read(size_t& original_size, char** data) = 0;
+    //
+    //2GiBを越えるデータも扱えるように、サイズはssize_tで返す
+    virtual ssize_t read(size_t& original_size, char** data) = 0;
+
+    //! ファイルのヘッダだけを読んで、read()で得られるデータのサイズを求める
+    //
+    //開いたファイルはread()またはread_into()で続けて使うので、同じファイルを2回開くことはない
+    //! @param [out]   original_size      read()で得られるデータ長（単位はByte)
+    //! @return -1: エラーによりヘッダが読めなかった
+    //! @return  0: 指定されたファイルが存在しなかった
+    //! @return  1: 正常終了
+    virtual int read_header(size_t& original_size) = 0;
+
+    //! read()と同じデータを、呼び出し側で確保した領域に直接読み込む
+    //! @param [out]   original_size      データ長（単位はByte)
+    //! @param [out]   dst                読み込んだデータを格納する領域
+    //! @param [in]    dst_size           dstの大きさ（単位はByte)
+    //! @return read()と同じ  データがdst_sizeに収まらない時は-1
+    //
+    //派生クラスで再定義しない時は、read()で読んだデータをdstにコピーする
+    virtual ssize_t read_into(size_t& original_size, char* dst, const size_t& dst_size);
+
+    //! read()で得られるデータが、変換無しでそのままファイルに格納されている位置を返す
+    //
+    //read_header()の後に呼び出すこと
+    //! @param [out]   extent_filename    データが格納されているファイル名
+    //! @param [out]   offset             ファイル先頭からデータまでのオフセット（単位はByte)
+    //! @param [out]   size               データ長（単位はByte)
+    //! @return 伸張やバイトオーダの変換が必要な時はfalse
+    virtual bool get_raw_extent(std::string& extent_filename, size_t& offset, size_t& size)
+    {
+        return false;
+    }
 
     //! ファイルに記録されたBOMが現在の処理系と一致するかどうか判定する
+    //
+    //read_header()の後は、ファイルを開き直さずに読み込み済のBOMで判定する
     bool isNativeEndian();
 
 protected:
     size_t size_of_datatype;
     std::string filename;
+    bool header_loaded;    //< ヘッダを読み込み済かどうか（ファイルを読み込む具象クラスが設定する）
+    int byte_order_mark;   //< ヘッダに記録されていたBOM
 
     template<typename T>
     void convert_endian(T* value)
@@ -68,14 +105,68 @@ protected:
 class ReadBinaryFile: public Read
 {
     friend class ReadFactory;
-    ReadBinaryFile(const std::string& filename, const int& size_of_datatype): Read(filename, size_of_datatype) {}
+    ReadBinaryFile(const std::string& filename, const int& size_of_datatype): Read(filename, size_of_datatype), header_original_size(0), header_actual_size(0) {}
 
 public:
     //! @attention 内部でnew char [] するので、*dataに確保済の領域を指定しないこと。
-    int read(size_t& original_size, char** data);
+    ssize_t read(size_t& original_size, char** data);
+    int read_header(size_t& original_size);
+    ssize_t read_into(size_t& original_size, char* dst, const size_t& dst_size);
+    bool get_raw_extent(std::string& extent_filename, size_t& offset, size_t& size);
 
     //! 引数で渡されたBOMが現在の処理系のものと一致するかどうかを判定する
     bool isNativeEndian(const int& byte_order_mark);
+
+private:
+    std::ifstream in;
+    size_t header_original_size;
+    size_t header_actual_size;
+};
+
+//! POSIX I/Oでバイナリ形式のファイルを読み込む具象クラス
+//
+//ReadBinaryFileと同じ形式のファイルを、ストリームバッファを経由せずにpreadで確保した領域に直接読み込む
+//directがtrueの時は、PosixIO::direct_threshold Byte以上のファイルをO_DIRECTで読み込む
+class ReadPosixFile: public Read
+{
+    friend class ReadFactory;
+    ReadPosixFile(const std::string& filename, const int& size_of_datatype, const bool& arg_direct): Read(filename, size_of_datatype), direct(arg_direct), fd(-1), header_original_size(0), header_actual_size(0) {}
+
+public:
+    ~ReadPosixFile();
+
+    //! @attention 内部でnew char [] するので、*dataに確保済の領域を指定しないこと。
+    ssize_t read(size_t& original_size, char** data);
+    int read_header(size_t& original_size);
+    ssize_t read_into(size_t& original_size, char* dst, const size_t& dst_size);
+    bool get_raw_extent(std::string& extent_filename, size_t& offset, size_t& size);
+
+private:
+    bool direct;
+    int fd;
+    size_t header_original_size;
+    size_t header_actual_size;
+};
+
+//! WriteSharedFileで出力された共有ファイルから指定された領域のデータを読み込む具象クラス
+class ReadSharedFile: public Read
+{
+    friend class ReadFactory;
+    ReadSharedFile(const std::string& filename, const int& size_of_datatype, const int& arg_region): Read(filename, size_of_datatype), region(arg_region) {}
+
+public:
+    //! @attention 内部でnew char [] するので、*dataに確保済の領域を指定しないこと。
+    ssize_t read(size_t& original_size, char** data);
+    int read_header(size_t& original_size);
+    ssize_t read_into(size_t& original_size, char* dst, const size_t& dst_size);
+    bool get_raw_extent(std::string& extent_filename, size_t& offset, size_t& size);
+
+private:
+    //! 読み込む領域の番号（出力時のRank番号）
+    int region;
+    std::ifstream in;
+    //! オフセットテーブル内の自領域のエントリ (original_size, actual_size, offset)
+    size_t entry[3];
 };
 
 //
@@ -93,35 +184,79 @@ public:
         delete base;
     }
 
+    //! デコーダはoriginal_sizeを変更しないので、baseのヘッダをそのまま返す
+    int read_header(size_t& original_size)
+    {
+        return base->read_header(original_size);
+    }
 
 protected:
     Read* base;
     char* buff;
 };
 
-//! zip形式による伸張機能を提供する具象デコレータ
-class ZipDecoder: public Decoder
+//! 圧縮されたデータの伸張を行う抽象デコレータ
+//
+//Encoderでチャンク分割して圧縮されたデータはOpenMPで並列に伸張する
+//チャンク分割を導入する前の形式（全体で1ストリーム）のデータも読み込める
+class ChunkedDecoder: public Decoder
 {
-    friend class ReadFactory;
-    explicit ZipDecoder(Read* arg) : Decoder(arg){}
+protected:
+    ChunkedDecoder(Read* arg) : Decoder(arg){}
 
 public:
-    int read(size_t& original_size, char** data);
+    ssize_t read(size_t& original_size, char** data);
+    ssize_t read_into(size_t& original_size, char* dst, const size_t& dst_size);
+
+protected:
+    //! 1チャンク分のデータを伸張する
+    //! @param [inout] dst_size   呼び出し時はdstの大きさ、終了時は伸張後のサイズ
+    virtual bool decode(char* src, const size_t& src_size, char* dst, size_t* dst_size) = 0;
+
+    //! チャンク分割されていない形式のデータを伸張する
+    virtual bool decode_stream(char* src, const size_t& src_size, char* dst, size_t* dst_size)
+    {
+        return decode(src, src_size, dst, dst_size);
+    }
+
+private:
+    //! base->read()で読んだsrcを伸張した後のサイズを返す  チャンクインデックスが壊れている時は-1
+    long decoded_size(const char* src, const size_t& src_size, const size_t& original_size);
+
+    //! srcを伸張してdstに出力する  dst_sizeにはdecoded_size()の値を渡すこと
+    //! @return 伸張後のサイズ  失敗した時は-1
+    ssize_t decode_all(char* src, const size_t& src_size, char* dst, const size_t& dst_size);
+};
+
+//! zlibのinflateによる伸張を行う抽象デコレータ
+class InflateDecoder: public ChunkedDecoder
+{
+protected:
+    InflateDecoder(Read* arg) : ChunkedDecoder(arg){}
+    bool decode(char* src, const size_t& src_size, char* dst, size_t* dst_size);
+};
+
+//! zip形式による伸張機能を提供する具象デコレータ
+class ZipDecoder: public InflateDecoder
+{
+    friend class ReadFactory;
+    explicit ZipDecoder(Read* arg) : InflateDecoder(arg){}
 };
 
 //! fpzip形式による伸張機能を提供する具象デコレータ
-class FpzipDecoder: public Decoder
+class FpzipDecoder: public ChunkedDecoder
 {
     friend class ReadFactory;
-    explicit FpzipDecoder(Read* arg, bool is_dp, int arg_vlen) : Decoder(arg),
+    explicit FpzipDecoder(Read* arg, bool is_dp, int arg_vlen) : ChunkedDecoder(arg),
         dp(0),
         vlen(arg_vlen)
     {
         if(is_dp)dp = 1;
     }
 
-public:
-    int read(size_t& original_size, char** data);
+protected:
+    bool decode(char* src, const size_t& src_size, char* dst, size_t* dst_size);
+    bool decode_stream(char* src, const size_t& src_size, char* dst, size_t* dst_size);
 
 private:
     int dp;
@@ -129,30 +264,128 @@ private:
 };
 
 //! RLEアルゴリズムによる伸張機能を提供する具象デコレータ
-class RLEDecoder: public Decoder
+class RLEDecoder: public InflateDecoder
 {
     friend class ReadFactory;
-    explicit RLEDecoder(Read* arg) : Decoder(arg) {}
+    explicit RLEDecoder(Read* arg) : InflateDecoder(arg) {}
+};
+
+//! shuffleフィルタの逆変換を行う具象デコレータ
+class ShuffleDecoder: public Decoder
+{
+    friend class ReadFactory;
+    explicit ShuffleDecoder(Read* arg, const size_t& arg_size_of_type) : Decoder(arg), size_of_type(arg_size_of_type) {}
 
 public:
-    int read(size_t& original_size, char** data);
+    ssize_t read(size_t& original_size, char** data);
+
+private:
+    size_t size_of_type;
+};
+
+//! bitshuffleフィルタの逆変換を行う具象デコレータ
+class BitShuffleDecoder: public Decoder
+{
+    friend class ReadFactory;
+    explicit BitShuffleDecoder(Read* arg, const size_t& arg_size_of_type) : Decoder(arg), size_of_type(arg_size_of_type) {}
+
+public:
+    ssize_t read(size_t& original_size, char** data);
+
+private:
+    size_t size_of_type;
+};
+
+//! delta + varint符号化されたデータを復号する具象デコレータ
+class DeltaDecoder: public Decoder
+{
+    friend class ReadFactory;
+    explicit DeltaDecoder(Read* arg) : Decoder(arg) {}
+
+public:
+    ssize_t read(size_t& original_size, char** data);
+};
+
+//! 量子化されたデータを復元する具象デコレータ
+class QuantizeDecoder: public Decoder
+{
+    friend class ReadFactory;
+    explicit QuantizeDecoder(Read* arg) : Decoder(arg) {}
+
+public:
+    ssize_t read(size_t& original_size, char** data);
+};
+
+//! temporal符号化されたデータを復元する具象デコレータ
+//
+//差分フレームの時は参照先のファイルを同じデコーダの組み合わせで読み込んで復元する
+//参照先も差分フレームの時は、キーフレームに辿り着くまで再帰的に読み込む
+class TemporalDecoder: public Decoder
+{
+    friend class ReadFactory;
+    TemporalDecoder(Read* arg, const std::string& arg_filename, const std::string& arg_decorator, const std::string& arg_type, const int& arg_NumComp, const int& arg_region, const std::string& arg_backend) : Decoder(arg),
+        filename(arg_filename),
+        decorator(arg_decorator),
+        type(arg_type),
+        NumComp(arg_NumComp),
+        region(arg_region),
+        backend(arg_backend){}
+
+public:
+    ssize_t read(size_t& original_size, char** data);
+
+private:
+    std::string filename;
+    std::string decorator;
+    std::string type;
+    int NumComp;
+    int region;
+    std::string backend;
 };
 
 //! エンディアン変換機能を提供する具象デコレータ
 class ConvertEndian: public Decoder
 {
     friend class ReadFactory;
-    explicit ConvertEndian(Read* arg, const int& arg_size_of_datatype) : Decoder(arg), size_of_datatype(arg_size_of_datatype) {}
+    ConvertEndian(Read* arg, const int& arg_size_of_datatype, Read* arg_file) : Decoder(arg), size_of_datatype(arg_size_of_datatype), file(arg_file) {}
     int size_of_datatype;
+    //! BOMを判定するためのファイル読み込みオブジェクト（baseのチェーンの末端）
+    Read* file;
+
+    //! fileのBOMが現在の処理系と異なる時は、dataのバイトオーダを反転する
+    void convert(char* data, const ssize_t& size);
+
 public:
-    int read(size_t& original_size, char** data);
+    ssize_t read(size_t& original_size, char** data);
+    ssize_t read_into(size_t& original_size, char* dst, const size_t& dst_size);
+
+    //! 変換が不要な時は、baseのデータの位置をそのまま返す
+    bool get_raw_extent(std::string& extent_filename, size_t& offset, size_t& size)
+    {
+        return file->isNativeEndian() && base->get_raw_extent(extent_filename, offset, size);
+    }
 };
 
 //! Readクラス用シンプルファクトリ
 class ReadFactory
 {
 public:
-    static Read* create(const std::string& filename, const std::string& decorator, const std::string& type, const int& NumComp);
+    //! regionに0以上の値が指定された時は、共有ファイル内の指定された領域を読み込むReadオブジェクトを生成する
+    //! backendはRank毎のファイルの読み込み方法
+    //!   "stream" : std::ifstream (ReadBinaryFile)
+    //!   "posix"  : pread (ReadPosixFile)
+    //!   "direct" : pread + 大きなファイルはO_DIRECT (ReadPosixFile)
+    static Read* create(const std::string& filename, const std::string& decorator, const std::string& type, const int& NumComp, const int& region = -1, const std::string& backend = "stream");
+
+private:
+    friend class TemporalDecoder;
+
+    //! エンディアン変換を除いたReadオブジェクトを生成する
+    //! @param [out] file_reader  チェーンの末端のファイル読み込みオブジェクト
+    static Read* create_decoders(const std::string& filename, const std::string& decorator, const std::string& type, const int& NumComp, const int& region, const std::string& backend, Read** file_reader = NULL);
+
+    //! typeで指定されたデータ型のサイズ（Byte)を返す
+    static int size_of(const std::string& type);
 };
 } //end of namespace
 #endif
@@ -0,0 +1,206 @@
+/*
+###################################################################################
+#
+# PDMlib - Particle Data Management library
+#
+# Copyright (c) 2014-2017 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2017 Research Institute for Information Technology (RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+*/
+
+#ifndef PDMLIB_SHUFFLE_H
+#define PDMLIB_SHUFFLE_H
+#include <cstring>
+#include <algorithm>
+#include <stdint.h>
+
+//! shuffle/bitshuffleフィルタの実装
+//
+//shuffle    : n要素 x size_of_type Byteのデータを転置し、各要素の0Byte目, 1Byte目,,,を順に並べる
+//bitshuffle : shuffleした後、各Byte列を8要素毎にビット単位で転置し、同じ桁のビットを並べる
+//
+//要素数が8の倍数でない時の端数要素（bitshuffleのみ）と、size_of_typeで割り切れない末尾のByteは
+//そのままの位置に格納する
+namespace BaseIO
+{
+namespace Shuffle
+{
+//! 1スレッドが一度に処理する要素数
+const size_t block_size = 4096;
+
+//! S>0の時はコンパイル時にS Byteとして展開し、S==0の時はsize_of_typeを使う
+template<int S>
+void byte_shuffle(const char* src, char* dst, const size_t& num_elements, const size_t& size_of_type)
+{
+    const size_t es         = S > 0 ? S : size_of_type;
+    const long   num_blocks = (num_elements+block_size-1)/block_size;
+#pragma omp parallel for schedule(static)
+    for(long b = 0; b < num_blocks; b++)
+    {
+        const size_t begin = b*block_size;
+        const size_t end   = std::min(num_elements, begin+block_size);
+        for(size_t j = 0; j < es; j++)
+        {
+            char*       d = dst+j*num_elements;
+            const char* s = src+j;
+            for(size_t i = begin; i < end; i++)
+            {
+                d[i] = s[i*es];
+            }
+        }
+    }
+}
+
+template<int S>
+void byte_unshuffle(const char* src, char* dst, const size_t& num_elements, const size_t& size_of_type)
+{
+    const size_t es         = S > 0 ? S : size_of_type;
+    const long   num_blocks = (num_elements+block_size-1)/block_size;
+#pragma omp parallel for schedule(static)
+    for(long b = 0; b < num_blocks; b++)
+    {
+        const size_t begin = b*block_size;
+        const size_t end   = std::min(num_elements, begin+block_size);
+        for(size_t j = 0; j < es; j++)
+        {
+            const char* s = src+j*num_elements;
+            char*       d = dst+j;
+            for(size_t i = begin; i < end; i++)
+            {
+                d[i*es] = s[i];
+            }
+        }
+    }
+}
+
+//! 8x8のビット行列（各Byteが1行）を転置する
+//
+//転置は2回行うと元に戻るので、逆変換にも同じ関数を使う
+inline uint64_t transpose8x8(uint64_t x)
+{
+    uint64_t t;
+    t = (x^(x>>7))&0x00AA00AA00AA00AAULL;
+    x = x^t^(t<<7);
+    t = (x^(x>>14))&0x0000CCCC0000CCCCULL;
+    x = x^t^(t<<14);
+    t = (x^(x>>28))&0x00000000F0F0F0F0ULL;
+    x = x^t^(t<<28);
+    return x;
+}
+
+//! length Byteの列を8Byte毎にビット転置し、同じ桁のビットを集めた8本の列にして出力する
+inline void bit_transpose(const char* src, char* dst, const size_t& length)
+{
+    const long num_groups = length/8;
+#pragma omp parallel for schedule(static)
+    for(long g = 0; g < num_groups; g++)
+    {
+        uint64_t x = 0;
+        for(int r = 0; r < 8; r++)
+        {
+            x |= (uint64_t)(unsigned char)src[g*8+r]<<(8*r);
+        }
+        x = transpose8x8(x);
+        for(int c = 0; c < 8; c++)
+        {
+            dst[c*num_groups+g] = (char)(x>>(8*c));
+        }
+    }
+    memcpy(dst+num_groups*8, src+num_groups*8, length-num_groups*8);
+}
+
+//! bit_transposeの逆変換
+inline void bit_untranspose(const char* src, char* dst, const size_t& length)
+{
+    const long num_groups = length/8;
+#pragma omp parallel for schedule(static)
+    for(long g = 0; g < num_groups; g++)
+    {
+        uint64_t x = 0;
+        for(int c = 0; c < 8; c++)
+        {
+            x |= (uint64_t)(unsigned char)src[c*num_groups+g]<<(8*c);
+        }
+        x = transpose8x8(x);
+        for(int r = 0; r < 8; r++)
+        {
+            dst[g*8+r] = (char)(x>>(8*r));
+        }
+    }
+    memcpy(dst+num_groups*8, src+num_groups*8, length-num_groups*8);
+}
+
+//! srcをshuffleしてdstに出力する
+inline void shuffle(const char* src, char* dst, const size_t& size, const size_t& size_of_type)
+{
+    const size_t num_elements = size_of_type > 0 ? size/size_of_type : 0;
+    switch(size_of_type)
+    {
+    case 2:
+        byte_shuffle<2>(src, dst, num_elements, size_of_type);
+        break;
+    case 4:
+        byte_shuffle<4>(src, dst, num_elements, size_of_type);
+        break;
+    case 8:
+        byte_shuffle<8>(src, dst, num_elements, size_of_type);
+        break;
+    default:
+        byte_shuffle<0>(src, dst, num_elements, size_of_type);
+        break;
+    }
+    memcpy(dst+num_elements*size_of_type, src+num_elements*size_of_type, size-num_elements*size_of_type);
+}
+
+//! shuffleの逆変換
+inline void unshuffle(const char* src, char* dst, const size_t& size, const size_t& size_of_type)
+{
+    const size_t num_elements = size_of_type > 0 ? size/size_of_type : 0;
+    switch(size_of_type)
+    {
+    case 2:
+        byte_unshuffle<2>(src, dst, num_elements, size_of_type);
+        break;
+    case 4:
+        byte_unshuffle<4>(src, dst, num_elements, size_of_type);
+        break;
+    case 8:
+        byte_unshuffle<8>(src, dst, num_elements, size_of_type);
+        break;
+    default:
+        byte_unshuffle<0>(src, dst, num_elements, size_of_type);
+        break;
+    }
+    memcpy(dst+num_elements*size_of_type, src+num_elements*size_of_type, size-num_elements*size_of_type);
+}
+
+//! srcをbitshuffleしてdstに出力する  workにはsize Byteの作業領域を渡すこと
+inline void bitshuffle(const char* src, char* dst, char* work, const size_t& size, const size_t& size_of_type)
+{
+    const size_t num_elements = size_of_type > 0 ? size/size_of_type : 0;
+    shuffle(src, work, size, size_of_type);
+    for(size_t j = 0; j < size_of_type; j++)
+    {
+        bit_transpose(work+j*num_elements, dst+j*num_elements, num_elements);
+    }
+    memcpy(dst+num_elements*size_of_type, work+num_elements*size_of_type, size-num_elements*size_of_type);
+}
+
+//! bitshuffleの逆変換  workにはsize Byteの作業領域を渡すこと
+inline void bitunshuffle(const char* src, char* dst, char* work, const size_t& size, const size_t& size_of_type)
+{
+    const size_t num_elements = size_of_type > 0 ? size/size_of_type : 0;
+    for(size_t j = 0; j < size_of_type; j++)
+    {
+        bit_untranspose(src+j*num_elements, work+j*num_elements, num_elements);
+    }
+    memcpy(work+num_elements*size_of_type, src+num_elements*size_of_type, size-num_elements*size_of_type);
+    unshuffle(work, dst, size, size_of_type);
+}
+} //end of namespace Shuffle
+} //end of namespace BaseIO
+#endif
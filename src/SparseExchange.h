@@ -0,0 +1,128 @@
+/*
+###################################################################################
+#
+# PDMlib - Particle Data Management library
+#
+# Copyright (c) 2014-2017 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2017 Research Institute for Information Technology (RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+*/
+
+#ifndef PDMLIB_SPARSE_EXCHANGE_H
+#define PDMLIB_SPARSE_EXCHANGE_H
+#include <mpi.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+namespace PDMlib
+{
+//! Rank番号をキーとした送受信データ（データの無い相手は含めない）
+typedef std::map<int, std::vector<char> > MessageMap;
+
+//! 1回のMPI_Isend/MPI_Irecvで送受信する最大のデータ長（Byte)
+//
+//MPIのcountはintなので、これを越えるメッセージは分割して送受信する
+static const size_t MaxMessageSize = 1UL<<30;
+
+//! @brief send_buffsの各メッセージを相手Rankに送り、自Rank宛てのメッセージをrecv_buffsに受け取る
+//
+//受信側は送信元もデータ長も事前に知らなくて良い
+//MPI-3以降では non-blocking consensus (NBX) で送信元を見つけるので
+//メモリと時間は実際に通信する相手の数にだけ比例する（RankのO(P)の配列を持たない）
+//  1. 全メッセージをMPI_Issendで送る
+//  2. MPI_Iprobeで届いたメッセージを受信しつつ、自分の送信が全て完了したらMPI_Ibarrierに入る
+//  3. MPI_Ibarrierが完了した時点で、全Rankの送信が受信済になっている
+//MPI-2では送信データ長をMPI_Alltoallで交換してから送受信する
+//
+//同じ送信元からの分割されたメッセージは同じtagで送るので、送った順に連結される
+//comm内の全Rankから呼び出すこと
+inline void SparseExchange(const MessageMap& send_buffs, MessageMap* recv_buffs, const MPI_Comm& comm, const int& tag)
+{
+    recv_buffs->clear();
+    std::vector<MPI_Request> requests;
+    for(MessageMap::const_iterator it = send_buffs.begin(); it != send_buffs.end(); ++it)
+    {
+        const std::vector<char>& buff = it->second;
+        for(size_t offset = 0; offset < buff.size(); offset += MaxMessageSize)
+        {
+            const int count = (int)std::min(buff.size()-offset, MaxMessageSize);
+            requests.push_back(MPI_REQUEST_NULL);
+#if MPI_VERSION >= 3
+            MPI_Issend(const_cast<char*>(&(buff[offset])), count, MPI_BYTE, it->first, tag, comm, &(requests.back()));
+#else
+            MPI_Isend(const_cast<char*>(&(buff[offset])), count, MPI_BYTE, it->first, tag, comm, &(requests.back()));
+#endif
+        }
+    }
+
+#if MPI_VERSION >= 3
+    MPI_Request barrier;
+    bool        barrier_active = false;
+    for(;;)
+    {
+        int        arrived;
+        MPI_Status status;
+        MPI_Iprobe(MPI_ANY_SOURCE, tag, comm, &arrived, &status);
+        if(arrived)
+        {
+            int count;
+            MPI_Get_count(&status, MPI_BYTE, &count);
+            std::vector<char>& buff = (*recv_buffs)[status.MPI_SOURCE];
+            const size_t       size = buff.size();
+            buff.resize(size+count);
+            MPI_Recv(&(buff[size]), count, MPI_BYTE, status.MPI_SOURCE, tag, comm, MPI_STATUS_IGNORE);
+        }
+
+        if(barrier_active)
+        {
+            int done;
+            MPI_Test(&barrier, &done, MPI_STATUS_IGNORE);
+            if(done) break;
+        }else{
+            int sent = 1;
+            if(!requests.empty())
+            {
+                MPI_Testall(requests.size(), &(requests[0]), &sent, MPI_STATUSES_IGNORE);
+            }
+            if(sent)
+            {
+                MPI_Ibarrier(comm, &barrier);
+                barrier_active = true;
+            }
+        }
+    }
+#else
+    int num_procs;
+    MPI_Comm_size(comm, &num_procs);
+    std::vector<unsigned long> send_sizes(num_procs, 0);
+    std::vector<unsigned long> recv_sizes(num_procs, 0);
+    for(MessageMap::const_iterator it = send_buffs.begin(); it != send_buffs.end(); ++it)
+    {
+        send_sizes[it->first] = it->second.size();
+    }
+    MPI_Alltoall(&(send_sizes[0]), 1, MPI_UNSIGNED_LONG, &(recv_sizes[0]), 1, MPI_UNSIGNED_LONG, comm);
+    for(int i = 0; i < num_procs; i++)
+    {
+        if(recv_sizes[i] == 0) continue;
+        std::vector<char>& buff = (*recv_buffs)[i];
+        buff.resize(recv_sizes[i]);
+        for(size_t offset = 0; offset < buff.size(); offset += MaxMessageSize)
+        {
+            const int count = (int)std::min(buff.size()-offset, MaxMessageSize);
+            requests.push_back(MPI_REQUEST_NULL);
+            MPI_Irecv(&(buff[offset]), count, MPI_BYTE, i, tag, comm, &(requests.back()));
+        }
+    }
+    if(!requests.empty())
+    {
+        MPI_Waitall(requests.size(), &(requests[0]), MPI_STATUSES_IGNORE);
+    }
+#endif
+}
+} //end of namespace PDMlib
+#endif
@@ -0,0 +1,131 @@
+/*
+###################################################################################
+#
+# PDMlib - Particle Data Management library
+#
+# Copyright (c) 2014-2017 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2017 Research Institute for Information Technology (RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+*/
+
+#ifndef PDMLIB_TEMPORAL_H
+#define PDMLIB_TEMPORAL_H
+#include <cstring>
+#include <string>
+#include <stdint.h>
+
+//! 直前の出力との差分を出力するtemporal符号化のフレーム形式
+//
+//キーフレームはデータをそのまま格納し、差分フレームは参照先(同じコンテナ、同じRankの直前の出力)
+//とのByte毎のXORを格納する
+//参照先は出力先ファイルのディレクトリからの相対パスで記録する（同じディレクトリならファイル名だけになる）
+//
+//  char     magic[4]          "PDMT"
+//  uint8    keyframe          キーフレームなら1
+//  uint8    reserved[3]
+//  uint64   raw_size          データサイズ(リトルエンディアン)
+//  uint32   reference_length  参照先の相対パスの長さ(リトルエンディアン) キーフレームの時は0
+//  char     reference[]       参照先の相対パス
+//  char     payload[raw_size]
+namespace BaseIO
+{
+namespace Temporal
+{
+const char magic[4] = {'P', 'D', 'M', 'T'};
+
+inline void put_le(char* dst, uint64_t value, const int& length)
+{
+    for(int i = 0; i < length; i++)
+    {
+        dst[i] = (char)(value&0xff);
+        value >>= 8;
+    }
+}
+
+inline uint64_t get_le(const char* src, const int& length)
+{
+    uint64_t value = 0;
+    for(int i = length-1; i >= 0; i--)
+    {
+        value = (value<<8)|(unsigned char)src[i];
+    }
+    return value;
+}
+
+//! 参照先ファイル名の長さがreference_lengthの時のヘッダサイズ
+inline size_t header_size(const size_t& reference_length)
+{
+    return 20+reference_length;
+}
+
+//! ヘッダを出力して、ヘッダのサイズを返す
+inline size_t write_header(char* dst, const size_t& raw_size, const std::string& reference)
+{
+    memcpy(dst, magic, sizeof(magic));
+    dst[4] = reference.empty() ? 1 : 0;
+    dst[5] = 0;
+    dst[6] = 0;
+    dst[7] = 0;
+    put_le(dst+8,  raw_size,         8);
+    put_le(dst+16, reference.size(), 4);
+    memcpy(dst+20, reference.c_str(), reference.size());
+    return header_size(reference.size());
+}
+
+inline bool is_encoded(const char* src, const size_t& src_size)
+{
+    return src_size >= header_size(0) && memcmp(src, magic, sizeof(magic)) == 0;
+}
+
+inline bool is_keyframe(const char* src)
+{
+    return src[4] != 0;
+}
+
+inline size_t raw_size(const char* src)
+{
+    return get_le(src+8, 8);
+}
+
+inline std::string reference(const char* src)
+{
+    return std::string(src+20, get_le(src+16, 4));
+}
+
+//! @brief filenameのディレクトリから見たreference_filenameの相対パスを返す
+//
+//2つのパスは同じ基準（どちらもカレントディレクトリからの相対パス、またはどちらも絶対パス）であること
+//sharded形式のように参照先が前のステップのディレクトリにある時は "../../foo_step_000001/r0000-0001/foo_0_1.x" のようになる
+inline std::string relative_path(const std::string& filename, const std::string& reference_filename)
+{
+    // 共通するディレクトリ部分を取り除く
+    size_t common = 0;
+    for(size_t i = 0; i < filename.size() && i < reference_filename.size() && filename[i] == reference_filename[i]; i++)
+    {
+        if(filename[i] == '/') common = i+1;
+    }
+    std::string relative;
+    for(size_t i = common; i < filename.size(); i++)
+    {
+        if(filename[i] == '/') relative += "../";
+    }
+    return relative+reference_filename.substr(common);
+}
+
+//! dst = a XOR b
+inline void xor_bytes(const char* a, const char* b, char* dst, const size_t& size)
+{
+    const long n = size;
+#pragma omp parallel for schedule(static)
+    for(long i = 0; i < n; i++)
+    {
+        dst[i] = a[i]^b[i];
+    }
+}
+} //end of namespace Temporal
+} //end of namespace BaseIO
+#endif
@@ -0,0 +1,486 @@
+/*
+###################################################################################
+#
+# PDMlib - Particle Data Management library
+#
+# Copyright (c) 2014-2017 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2017 Research Institute for Information Technology (RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+*/
+
+#ifndef PDMLIB_TIME_SLICE_INDEX_H
+#define PDMLIB_TIME_SLICE_INDEX_H
+#include <stdint.h>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "PosixIO.h"
+
+//! タイムスライス情報のバイナリインデックス
+//
+//DFIファイルと同じディレクトリに"DFIファイル名.index"として出力する
+//
+//ヘッダ
+//  char     magic[4]        "PDMI"
+//  uint32_t version
+//  uint32_t num_containers
+//  uint32_t num_procs
+//  uint64_t header_size     先頭のレコードの位置
+//  uint64_t record_size     1レコードのサイズ
+//  コンテナ毎に名前とCompressionを'\0'終端で格納し、header_sizeまで0で埋める
+//
+//レコード（出力したタイムステップ毎に固定長で、出力した順に並ぶ）
+//  int64_t  time_step
+//  double   time
+//  uint64_t complete        Rank0がレコード全体を書き込んだ時はtime_step+1、それ以外は0
+//  コンテナ毎の要約 : uint64_t flags(has_min_max|has_total), uint64_t total, double min_max[8]
+//                     totalとmin_maxはWrite()内で全Rank分を集約した時だけ記録される
+//  Rank毎の行       : uint64_t tag(time_step+1), コンテナ毎に uint64_t num_particles, uint64_t num_bytes
+//
+//Write()内で全Rankの統計値を集約している時（GlobalTimeSlice/AutoMinMax）は、ファイル出力後に
+//MinMax値、粒子数、出力サイズを1回のMPI_GatherでRank0に集め（MinMax::gather()）、
+//Rank0がcompleteを含むレコード全体を1回のpwriteで書き込む
+//他のRankはインデックスに書き込まないので、タイムステップ毎の書き込みは1回になり、
+//出力が完了したかどうかはcompleteを見るだけで判定できる
+//
+//非同期出力やバッファリング時のように、ファイル出力の完了がRank毎に異なるタイミングになる時は
+//集団操作を行えないので、Rank0はレコードの先頭から自Rankの行までを、他のRankは自Rankの行だけを
+//1回のpwriteで書き込む（タイムステップ毎にRank数回の書き込みになる）
+//この時はcompleteは0のままで、全Rankの行のtagがtime_step+1になっているレコードを出力が完了したタイムステップとみなす
+//
+//レコードの位置は各Rankが記録したタイムステップの数で決まるので、全Rankが同じタイムステップの列を
+//同じ順序で記録すること（あるRankだけがタイムステップを飛ばしたり繰り返したりすると、以降の行がずれる）
+//
+//値は出力した処理系のバイトオーダで格納する
+namespace PDMlib
+{
+namespace TimeSliceIndex
+{
+const char     magic[4] = {'P', 'D', 'M', 'I'};
+const uint32_t version  = 3;
+
+//! 要約のflagsの値
+const uint64_t has_min_max = 1;
+const uint64_t has_total   = 2;
+
+//! 固定長部分のヘッダサイズ
+const size_t fixed_header_size = 4+3*sizeof(uint32_t)+2*sizeof(uint64_t);
+
+//! レコード先頭のtime_step, time, completeのサイズ
+const size_t record_header_size = 3*8;
+
+//! コンテナ毎の要約のサイズ
+const size_t summary_size = 2*8+8*8;
+
+//! Rank毎の行のサイズ
+inline size_t row_size(const size_t& num_containers)
+{
+    return 8+num_containers*2*8;
+}
+
+//! 1レコードのサイズ
+inline size_t record_size(const size_t& num_containers, const size_t& num_procs)
+{
+    return record_header_size+num_containers*summary_size+num_procs*row_size(num_containers);
+}
+
+//! レコードの先頭からmy_rankの行までのオフセット
+inline size_t row_offset(const size_t& num_containers, const size_t& my_rank)
+{
+    return record_header_size+num_containers*summary_size+my_rank*row_size(num_containers);
+}
+
+//! インデックスのファイル名
+inline std::string filename(const std::string& dfi_filename)
+{
+    return dfi_filename+".index";
+}
+
+//! タイムスライス情報をインデックスに書き込むクラス
+//
+//1タイムステップ分の全コンテナが揃った時か、タイムステップが変わった時にレコードを書き込む
+//全コンテナを集団操作で記録したタイムステップは、Rank0がレコード全体を書き込む
+//それ以外は各Rankが自Rankの値だけを保持し、レコード内の自Rankの行を書き込む
+class Writer
+{
+public:
+    Writer() : fd(-1), my_rank(0), num_procs(0), num_containers(0), header_size(0), num_records(0), current_step(-1), num_recorded(0), all_collective(false), row(NULL){}
+
+    ~Writer()
+    {
+        close();
+    }
+
+    //! @brief インデックスの出力を開始する
+    //
+    //Rank0はファイルを作り直してヘッダを書き込む
+    //他のRankが書き込み始めるのはRank0がファイルを作り直した後になるように、呼び出し側で同期すること
+    //! @param [in] names         コンテナ名
+    //! @param [in] compressions  コンテナ毎のCompression
+    void open(const std::string& index_filename, const std::vector<std::string>& names, const std::vector<std::string>& compressions, const int& arg_my_rank, const int& arg_num_procs)
+    {
+        close();
+        filename       = index_filename;
+        my_rank        = arg_my_rank;
+        num_procs      = arg_num_procs;
+        num_containers = names.size();
+        header_size    = 0;
+        num_records    = 0;
+        current_step   = -1;
+
+        // ヘッダの内容は引数だけで決まるので、全Rankで作ってheader_sizeを求める
+        // ファイルに書き込むのはRank0だけで、他のRankはファイルからheader_sizeを読み直さない
+        std::vector<char> header(fixed_header_size);
+        for(size_t i = 0; i < names.size(); i++)
+        {
+            header.insert(header.end(), names[i].c_str(), names[i].c_str()+names[i].size()+1);
+            header.insert(header.end(), compressions[i].c_str(), compressions[i].c_str()+compressions[i].size()+1);
+        }
+        header.resize((header.size()+7)/8*8, 0);
+
+        const uint32_t u32[3] = {version, (uint32_t)num_containers, (uint32_t)num_procs};
+        const uint64_t u64[2] = {header.size(), record_size(num_containers, num_procs)};
+        memcpy(&(header[0]), magic, 4);
+        memcpy(&(header[4]), u32, sizeof(u32));
+        memcpy(&(header[4+sizeof(u32)]), u64, sizeof(u64));
+        header_size = header.size();
+        if(my_rank != 0) return;
+
+        fd = ::open(filename.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+        if(fd < 0 || !BaseIO::PosixIO::pwrite_all(fd, &(header[0]), header.size(), 0))
+        {
+            std::cerr<<"failed to write time slice index ("<<filename<<")"<<std::endl;
+        }
+    }
+
+    //! 書き込み中のタイムステップの行を書き込んでファイルを閉じる
+    void close(void)
+    {
+        flush();
+        if(fd >= 0) ::close(fd);
+        fd = -1;
+    }
+
+    //! @brief 1コンテナ分のタイムスライス情報を記録する
+    //
+    //! @param [in] container_index コンテナの番号（コンテナ名の順番）
+    //! @param [in] min_max         最小/最大値  無い時はNULL
+    //! @param [in] total           全Rankの粒子数の合計  集約していない時は負の値
+    //! @param [in] collective      全Rankの値をRank0に集めた時はtrue（全Rankで同じ値を渡すこと）
+    //! @param [in] rows            collectiveの時のRank毎の粒子数と出力サイズ（Rank0のみ参照する  MinMax::gather()を参照）
+    //
+    //min_maxとtotalはRank0の値だけが記録される
+    void record(const int& container_index, const int& time_step, const double& time, const uint64_t& num_particles, const uint64_t& num_bytes, const double* min_max, const int64_t& total = -1, const bool& collective = false, const uint64_t* rows = NULL)
+    {
+        if(filename.empty() || container_index < 0 || container_index >= (int)num_containers) return;
+        if(time_step != current_step)
+        {
+            flush();
+            // Rank0は他のRankの行も集めるので、レコード全体の領域を持つ
+            const size_t size = my_rank == 0 ? record_size(num_containers, num_procs) : row_size(num_containers);
+            buff.assign(size/8, 0);
+            current_step   = time_step;
+            num_recorded   = 0;
+            all_collective = true;
+            row            = my_rank == 0 ? &(buff[row_offset(num_containers, 0)/8]) : &(buff[0]);
+            row[0]         = (uint64_t)time_step+1;
+            if(my_rank == 0)
+            {
+                const int64_t step = time_step;
+                memcpy(&(buff[0]), &step, 8);
+                memcpy(&(buff[1]), &time, 8);
+            }
+        }
+        row[1+2*container_index] = num_particles;
+        row[2+2*container_index] = num_bytes;
+        all_collective = all_collective && collective;
+        if(all_collective && my_rank == 0 && rows != NULL)
+        {
+            for(size_t rank = 0; rank < num_procs; rank++)
+            {
+                uint64_t* rank_row = &(buff[row_offset(num_containers, rank)/8]);
+                rank_row[0]                   = (uint64_t)time_step+1;
+                rank_row[1+2*container_index] = rows[2*rank];
+                rank_row[2+2*container_index] = rows[2*rank+1];
+            }
+        }
+        if(my_rank == 0)
+        {
+            uint64_t* summary = &(buff[(record_header_size+container_index*summary_size)/8]);
+            if(min_max != NULL)
+            {
+                summary[0] |= has_min_max;
+                memcpy(summary+2, min_max, 8*sizeof(double));
+            }
+            if(total >= 0)
+            {
+                summary[0] |= has_total;
+                summary[1]  = total;
+            }
+        }
+        if(++num_recorded == num_containers)
+        {
+            flush();
+        }
+    }
+
+private:
+    //non-copyable
+    Writer(const Writer&);
+    Writer& operator=(const Writer&);
+
+    //! @brief 記録中のタイムステップを書き込む
+    //
+    //全コンテナを集団操作で記録した時は、Rank0がcompleteを立ててレコード全体を書き込み、他のRankは何もしない
+    //それ以外はRank0がレコードの先頭から自Rankの行までを、他のRankは自Rankの行を書き込む
+    void flush(void)
+    {
+        if(current_step < 0) return;
+        const size_t record = num_records++;
+        if(all_collective && my_rank != 0)
+        {
+            current_step = -1;
+            return;
+        }
+        size_t size = buff.size()*8;
+        if(my_rank == 0)
+        {
+            buff[2] = all_collective ? (uint64_t)current_step+1 : 0;
+            size    = all_collective ? record_size(num_containers, num_procs) : row_offset(num_containers, 0)+row_size(num_containers);
+        }
+        current_step = -1;
+        if(fd < 0)
+        {
+            fd = ::open(filename.c_str(), O_WRONLY|O_CREAT, 0644);
+            if(fd < 0) return;
+        }
+        const off_t offset = header_size+record*record_size(num_containers, num_procs)+(my_rank == 0 ? 0 : row_offset(num_containers, my_rank));
+        if(!BaseIO::PosixIO::pwrite_all(fd, (const char*)&(buff[0]), size, offset))
+        {
+            std::cerr<<"failed to write time slice index ("<<filename<<")"<<std::endl;
+        }
+    }
+
+    std::string filename;
+    int fd;
+    int my_rank;
+    size_t num_procs;
+    size_t num_containers;
+    size_t header_size;
+    size_t num_records;            //< 書き込み済のレコード数
+    int current_step;              //< 記録中のタイムステップ（記録中で無い時は-1）
+    size_t num_recorded;           //< 記録中のタイムステップで記録したコンテナ数
+    bool all_collective;           //< 記録中のタイムステップの全コンテナを集団操作で記録したかどうか
+    std::vector<uint64_t> buff;    //< 書き込む内容（Rank0はレコード全体、他のRankは自Rankの行）
+    uint64_t* row;                 //< buff内の自Rankの行
+};
+
+//! インデックスをmmapして参照するクラス
+class Reader
+{
+public:
+    Reader() : base(NULL), map_base(NULL), map_size(0), file_size(0), num_containers(0), num_procs(0), header_size(0), rec_size(0), num_records(0){}
+
+    ~Reader()
+    {
+        unload();
+    }
+
+    //! @brief インデックスをmmapする
+    //! @return ファイルが無い時や形式が異なる時はfalse
+    bool load(const std::string& index_filename)
+    {
+        unload();
+        struct stat st;
+        if(stat(index_filename.c_str(), &st) != 0 || (size_t)st.st_size < fixed_header_size) return false;
+        base = BaseIO::PosixIO::map_file(index_filename.c_str(), 0, st.st_size, &map_base, &map_size);
+        if(base == NULL) return false;
+
+        uint32_t u32[3];
+        uint64_t u64[2];
+        memcpy(u32, base+4, sizeof(u32));
+        memcpy(u64, base+4+sizeof(u32), sizeof(u64));
+        num_containers = u32[1];
+        num_procs      = u32[2];
+        header_size    = u64[0];
+        rec_size       = u64[1];
+        if(memcmp(base, magic, 4) != 0 || u32[0] != version || rec_size != record_size(num_containers, num_procs) || header_size > (size_t)st.st_size)
+        {
+            unload();
+            return false;
+        }
+        // 末尾のレコードは一部のRankの行しか書かれていないことがあるので切り上げる
+        file_size   = st.st_size;
+        num_records = (file_size-header_size+rec_size-1)/rec_size;
+
+        const char* p = base+fixed_header_size;
+        for(size_t i = 0; i < num_containers; i++)
+        {
+            names.push_back(p);
+            p += names.back().size()+1;
+            compressions.push_back(p);
+            p += compressions.back().size()+1;
+        }
+        return true;
+    }
+
+    void unload(void)
+    {
+        if(base != NULL) BaseIO::PosixIO::unmap_file(map_base, map_size);
+        base = NULL;
+        num_records = 0;
+        names.clear();
+        compressions.clear();
+    }
+
+    //! レコード数
+    size_t size(void) const {return num_records;}
+
+    //! i番目のレコードのタイムステップ
+    int time_step(const size_t& i) const {return (int)get<int64_t>(i, 0);}
+
+    //! i番目のレコードの時刻
+    double time(const size_t& i) const {return get<double>(i, 8);}
+
+    //! @brief i番目のレコードが全Rank分書き込まれているかどうか
+    //
+    //Rank0がレコード全体を書き込んだ時はcompleteだけを見る
+    //Rank毎に行を書き込んだレコードは全Rankの行のtagを調べる
+    bool is_complete(const size_t& i) const
+    {
+        const int64_t step = get<int64_t>(i, 0);
+        if(get<uint64_t>(i, 16) == (uint64_t)step+1) return true;
+        for(size_t rank = 0; rank < num_procs; rank++)
+        {
+            if(get<uint64_t>(i, row_offset(num_containers, rank)) != (uint64_t)step+1) return false;
+        }
+        return true;
+    }
+
+    //! @brief 全Rank分書き込まれている最新のレコードの番号
+    //
+    //末尾から順に調べるので、最後のタイムステップが書き込み中でなければ1レコードを見るだけで済む
+    //集団操作で記録したレコードは1レコードあたりcompleteの1箇所を見るだけで済む
+    //! @return 該当するレコードが無い時は-1
+    long latest_complete(void) const
+    {
+        for(long i = (long)num_records-1; i >= 0; i--)
+        {
+            if(is_complete(i)) return i;
+        }
+        return -1;
+    }
+
+    //! @brief time_stepの全Rank分書き込まれたレコードの番号
+    //! @return 該当するレコードが無い時は-1
+    long find(const int& step) const
+    {
+        for(long i = (long)num_records-1; i >= 0; i--)
+        {
+            if(time_step(i) == step && is_complete(i)) return i;
+        }
+        return -1;
+    }
+
+    //! 全Rank分書き込まれているレコードのタイムステップの一覧
+    void complete_steps(std::vector<int>* steps) const
+    {
+        for(size_t i = 0; i < num_records; i++)
+        {
+            if(is_complete(i)) steps->push_back(time_step(i));
+        }
+    }
+
+    //! i番目のレコードのcontainerの最小/最大値  記録されていない時はfalse
+    bool min_max(const size_t& i, const size_t& container, double min_max[8]) const
+    {
+        const size_t offset = record_header_size+container*summary_size;
+        if((get<uint64_t>(i, offset)&has_min_max) == 0) return false;
+        for(int j = 0; j < 8; j++)
+        {
+            min_max[j] = get<double>(i, offset+16+8*j);
+        }
+        return true;
+    }
+
+    //! @brief i番目のレコードのcontainerの全Rankの粒子数の合計
+    //
+    //Write()内で集約した値が無い時は、各Rankの行の値を合計する
+    uint64_t total_particles(const size_t& i, const size_t& container) const
+    {
+        const size_t offset = record_header_size+container*summary_size;
+        if((get<uint64_t>(i, offset)&has_total) != 0) return get<uint64_t>(i, offset+8);
+        uint64_t total = 0;
+        for(size_t rank = 0; rank < num_procs; rank++)
+        {
+            total += num_particles(i, container, rank);
+        }
+        return total;
+    }
+
+    //! i番目のレコードのrankが出力したcontainerの粒子数
+    uint64_t num_particles(const size_t& i, const size_t& container, const size_t& rank) const
+    {
+        return get<uint64_t>(i, row_offset(num_containers, rank)+8+16*container);
+    }
+
+    //! i番目のレコードのrankが出力したcontainerのファイルサイズ（Byte)
+    uint64_t num_bytes(const size_t& i, const size_t& container, const size_t& rank) const
+    {
+        return get<uint64_t>(i, row_offset(num_containers, rank)+16+16*container);
+    }
+
+    //! 出力時のRank数
+    size_t get_num_procs(void) const {return num_procs;}
+
+    //! コンテナ名の番号  見つからない時は-1
+    int container_index(const std::string& name) const
+    {
+        for(size_t i = 0; i < names.size(); i++)
+        {
+            if(names[i] == name) return i;
+        }
+        return -1;
+    }
+
+    //! containerのCompression
+    const std::string& compression(const size_t& container) const {return compressions[container];}
+
+private:
+    //non-copyable
+    Reader(const Reader&);
+    Reader& operator=(const Reader&);
+
+    //! ファイル末尾より後ろの値はまだ書かれていないものとして0を返す
+    template<typename T>
+    T get(const size_t& i, const size_t& offset) const
+    {
+        const size_t pos = header_size+i*rec_size+offset;
+        T value          = 0;
+        if(pos+sizeof(T) <= file_size)
+        {
+            memcpy(&value, base+pos, sizeof(T));
+        }
+        return value;
+    }
+
+    const char* base;
+    void*  map_base;
+    size_t map_size;
+    size_t file_size;
+    size_t num_containers;
+    size_t num_procs;
+    size_t header_size;
+    size_t rec_size;
+    size_t num_records;
+    std::vector<std::string> names;
+    std::vector<std::string> compressions;
+};
+} //end of namespace TimeSliceIndex
+} //end of namespace PDMlib
+#endif
@@ -15,7 +15,9 @@
 #ifndef PDMLIB_UTIL_H
 #define PDMLIB_UTIL_H
 #include <cstdlib>
+#include <stdint.h>
 #include <string>
+#include <vector>
 #include <set>
 #include <climits>
 #include <sstream>
@@ -25,13 +27,13 @@ namespace PDMlib
 {
 //! @brief 実行中の処理系がlittle-endianかどうかを確認する
 //
-//! int型の1をファイルに書き込んだ時にMost Significant Byteが1になっていれば
+//! int型の1のメモリ上の先頭Byteが1になっていれば
 //! little  endianと判定している
 bool is_little(void);
 
 //! @brief 実行中の処理系がbig-endianかどうかを確認する
 //
-//! int型の1をファイルに書き込んだ時にLeast Significant Byteが1になっていれば
+//! int型の1のメモリ上の末尾Byteが1になっていれば
 //! big endianと判定している
 bool is_big(void);
 
@@ -44,6 +46,21 @@ bool isFile(const std::string& filename);
 //indexは0オリジン
 int GetStartIndex(const int& N, const int& NumProc, const int& MyRank);
 
+//! 1つのファイルから読む粒子の範囲
+struct ParticleRange
+{
+    int file;          //< ファイルの番号
+    uint64_t first;    //< ファイル内の先頭の粒子番号
+    uint64_t count;    //< 粒子数
+};
+
+//! @brief ファイル毎の粒子を番号順に並べてNumProcでブロック分割したときに、MyRankが担当する範囲を返す
+//
+//余りはGetStartIndex()と同じく前半Rankが1粒子づつ追加で担当する
+//! @param [in]  counts ファイル毎の粒子数
+//! @param [out] ranges MyRankの範囲にかかるファイル毎の範囲（粒子数が0のファイルは含まない）
+void GetBalancedRanges(const std::vector<uint64_t>& counts, const int& NumProc, const int& MyRank, std::vector<ParticleRange>* ranges);
+
 //! 指定されたディレクトリ以下にあるファイルの一覧を返す
 //
 //! glob(3)に対するラッパー
@@ -146,5 +163,25 @@ bool mkdir_if_not_exist(const std::string& path);
 
 /// 再帰的に指定されたパスのディレクトリを作成する
 bool RecursiveMkdir(const std::string& path);
+
+/// @brief comm内の全Rankで使うディレクトリをまとめて作成する
+///
+/// ノード毎に1Rankだけが各パスに対してRecursiveMkdir()を呼び、結果をcomm内で集約する
+/// ノードローカルなファイルシステムにも対応するため、代表Rankはノード毎に選ぶ
+/// comm内の全Rankから呼び出すこと
+/// @return 全ノードで全てのディレクトリが作成できた時はtrue
+bool CollectiveMkdir(const std::vector<std::string>& paths, const MPI_Comm& comm);
+
+/// @brief CollectiveMkdir()と同じ処理を、呼び出し側で作成済のノード内コミュニケータを使って行う
+///
+/// node_comm内のRank0が代表Rankとなる 同じcommで繰り返し呼び出す時に、毎回コミュニケータを分割しないために使う
+/// @param [in] node_comm SplitNodeComm(comm)で作成したコミュニケータ
+bool CollectiveMkdir(const std::vector<std::string>& paths, const MPI_Comm& comm, const MPI_Comm& node_comm);
+
+/// @brief commを同じノード上のRank毎に分割したコミュニケータを返す
+///
+/// MPI-3より前の環境ではcomm全体を1ノードとして扱う
+/// 不要になったら呼び出し側でMPI_Comm_free()すること
+MPI_Comm SplitNodeComm(const MPI_Comm& comm);
 } //end of namespace
 #endif
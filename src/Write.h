@@ -14,8 +14,13 @@
 
 #ifndef PDMLIB_WRITE_H
 #define PDMLIB_WRITE_H
+#include <mpi.h>
 #include <fstream>
 #include <climits>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+#include <zlib.h>
 
 namespace BaseIO
 {
@@ -38,7 +43,10 @@ public:
     //! @param [in] original_size 圧縮前のデータサイズ（Byte)
     //! @param [in] actual_size   実際の出力サイズ（Byte)
     //! @param [in] data          出力データ
-    virtual int write(const char* filename, const size_t& original_size, const size_t& actual_size, char* data) = 0;
+    //! @return 出力したデータサイズ（Byte)  失敗した時は負の値
+    //
+    //2GiBを越えるデータも扱えるように、サイズはssize_tで返す
+    virtual ssize_t write(const char* filename, const size_t& original_size, const size_t& actual_size, char* data) = 0;
 };
 
 //! 抽象ファイル出力クラス
@@ -46,7 +54,7 @@ class WriteFile: public Write
 {
 public:
     virtual ~WriteFile(){}
-    virtual int write(const char* filename, const size_t& original_size, const size_t& actual_size, char* data) = 0;
+    virtual ssize_t write(const char* filename, const size_t& original_size, const size_t& actual_size, char* data) = 0;
 
 protected:
     std::ofstream out;
@@ -73,7 +81,7 @@ class WriteTextFile: public WriteFile
     }
 
 public:
-    int write(const char* filename, const size_t& original_size, const size_t& actual_size, char* data);
+    ssize_t write(const char* filename, const size_t& original_size, const size_t& actual_size, char* data);
 
 private:
     std::string type;
@@ -88,7 +96,71 @@ class WriteBinaryFile: public WriteFile
     WriteBinaryFile(){}
 
 public:
-    int write(const char* filename, const size_t& original_size, const size_t& actual_size, char* data);
+    ssize_t write(const char* filename, const size_t& original_size, const size_t& actual_size, char* data);
+};
+
+//! POSIX I/Oでバイナリ形式のファイル出力を行う具象クラス
+//
+//出力形式はWriteBinaryFileと同じ
+//ヘッダとデータはwritevで1回のシステムコールにまとめて出力し、ストリームバッファへのコピーを行わない
+//directがtrueの時は、PosixIO::direct_threshold Byte以上のデータをO_DIRECTで出力する
+class WritePosixFile: public Write
+{
+    friend class WriteFactory;
+    explicit WritePosixFile(const bool& arg_direct) : direct(arg_direct){}
+
+public:
+    ssize_t write(const char* filename, const size_t& original_size, const size_t& actual_size, char* data);
+
+private:
+    bool direct;
+};
+
+//! WriteMemoryBlockの出力先となる領域
+struct MemoryBlock
+{
+    size_t original_size;   //< 圧縮前のデータサイズ（Byte)
+    size_t actual_size;     //< dataのデータ長（Byte)
+    char*  data;            //< write()内でnew char[]して確保する。解放は呼び出し側で行うこと
+};
+
+//! ファイル出力を行わずに、出力するはずだったデータをメモリ上に保持する具象クラス
+//
+//出力バッファリング時にエンコード済のデータを溜めておくために使う
+//filenameは無視される
+class WriteMemoryBlock: public Write
+{
+    friend class WriteFactory;
+    explicit WriteMemoryBlock(MemoryBlock* arg_block) : block(arg_block){}
+
+public:
+    ssize_t write(const char* filename, const size_t& original_size, const size_t& actual_size, char* data);
+
+private:
+    MemoryBlock* block;
+};
+
+//! 全Rankのデータを1つのファイルにMPI-IOで出力する具象クラス
+//
+//ファイルの先頭にはWriteBinaryFileと同じsize_of_int, size_of_size_t, BOMに続けて
+//領域数(int)と、領域毎の(original_size, actual_size, offset)をsize_tで格納したテーブルを出力し
+//その後に各Rankのデータを領域番号順に出力する
+//データの先頭は、無圧縮のデータをmmapして参照できるようにdata_alignment Byte境界に揃える
+//
+//@attention comm内の全Rankから呼び出すこと（出力データが無いRankもactual_size=0で呼び出す）
+class WriteSharedFile: public Write
+{
+    friend class WriteFactory;
+    explicit WriteSharedFile(const MPI_Comm& arg_comm) : comm(arg_comm){}
+
+public:
+    ssize_t write(const char* filename, const size_t& original_size, const size_t& actual_size, char* data);
+
+private:
+    //! データの先頭を揃える境界（Byte) PDMlibで扱う型のサイズの最大値
+    static const size_t data_alignment = 8;
+
+    MPI_Comm comm;
 };
 
 //
@@ -96,50 +168,138 @@ public:
 //
 //! 抽象デコレータ
 //
-//!privateメンバのbuffはwrite内で確保して圧縮用の一次領域として使うためのもの
+//!privateメンバのbuffはwrite内で確保して一次領域として使うためのもの
+//!同じオブジェクトでwriteを繰り返し呼んだ時に再確保しないように、領域は必要な時だけ拡張する
 class Encoder: public Write
 {
 protected:
     Encoder(Write* arg) : base(arg),
-        buff(NULL){}
+        buff(NULL),
+        buff_size(0){}
 
 public:
     virtual ~Encoder()
     {
         delete base;
-        delete buff;
+        delete[] buff;
     }
 
-    virtual int write(const char* filename, const size_t& original_size, const size_t& actual_size, char* data) = 0;
+    virtual ssize_t write(const char* filename, const size_t& original_size, const size_t& actual_size, char* data) = 0;
 
 protected:
+    //! buffが少なくともsize Byteの領域を持つようにする
+    char* reserve(const size_t& size)
+    {
+        if(size > buff_size)
+        {
+            delete[] buff;
+            buff      = new char[size];
+            buff_size = size;
+        }
+        return buff;
+    }
+
     Write* base;
     char*  buff;
+    size_t buff_size;
 };
 
-//! zip形式による圧縮機能を提供する具象デコレータ
-class ZipEncoder: public Encoder
+//! 圧縮を行う抽象デコレータ
+//
+//!入力データをChunkIndex::chunk_size毎のチャンクに分割し、OpenMPで並列に圧縮してbaseに渡す
+//!出力形式はChunkIndex.hを参照
+class ChunkedEncoder: public Encoder
 {
-    friend class WriteFactory;
-    explicit ZipEncoder(Write* arg) : Encoder(arg){}
+protected:
+    ChunkedEncoder(Write* arg) : Encoder(arg){}
+
+public:
+    ssize_t write(const char* filename, const size_t& original_size, const size_t& actual_size, char* data);
+
+protected:
+    //! num_threads個のスレッドから同時にencode()を呼べるように作業領域を準備する
+    virtual bool prepare(const int& num_threads) = 0;
+
+    //! 1チャンク分のデータを圧縮する
+    //! @param [in]    thread_id  prepare()で準備した作業領域の番号
+    //! @param [inout] dst_size   呼び出し時はdstの大きさ、終了時は圧縮後のサイズ
+    virtual bool encode(const int& thread_id, char* src, const size_t& src_size, char* dst, size_t* dst_size) = 0;
+
+    //! src_size Byteのデータを圧縮した時の最大サイズ
+    virtual size_t bound(const size_t& src_size) = 0;
+
+    //! チャンクの境界を揃える単位（Byte)
+    virtual size_t unit(void)
+    {
+        return 1;
+    }
+};
+
+//! zlibのdeflateによる圧縮を行う抽象デコレータ
+//
+//z_streamはスレッド毎に最初に使う時に1度だけ初期化し、チャンク毎にdeflateResetして再利用する
+class DeflateEncoder: public ChunkedEncoder
+{
+protected:
+    DeflateEncoder(Write* arg, const int& arg_strategy) : ChunkedEncoder(arg),
+        strategy(arg_strategy){}
 
 public:
-    int write(const char* filename, const size_t& original_size, const size_t& actual_size, char* data);
+    virtual ~DeflateEncoder()
+    {
+        for(std::vector<z_stream*>::iterator it = z.begin(); it != z.end(); ++it)
+        {
+            deflateEnd(*it);
+            delete *it;
+        }
+    }
+
+protected:
+    bool prepare(const int& num_threads);
+    bool encode(const int& thread_id, char* src, const size_t& src_size, char* dst, size_t* dst_size);
+    size_t bound(const size_t& src_size)
+    {
+        return compressBound(src_size);
+    }
+
+private:
+    int strategy;
+    std::vector<z_stream*> z;
+};
+
+//! zip形式による圧縮機能を提供する具象デコレータ
+class ZipEncoder: public DeflateEncoder
+{
+    friend class WriteFactory;
+    explicit ZipEncoder(Write* arg) : DeflateEncoder(arg, Z_DEFAULT_STRATEGY){}
 };
 
 //! fpzip形式による圧縮機能を提供する具象デコレータ
-class FpzipEncoder: public Encoder
+class FpzipEncoder: public ChunkedEncoder
 {
     friend class WriteFactory;
-    explicit FpzipEncoder(Write* arg, bool is_dp, int arg_vlen) : Encoder(arg),
+    explicit FpzipEncoder(Write* arg, bool is_dp, int arg_vlen) : ChunkedEncoder(arg),
         dp(0),
         vlen(arg_vlen)
     {
         if(is_dp)dp = 1;
     }
 
-public:
-    int write(const char* filename, const size_t& original_size, const size_t& actual_size, char* data);
+protected:
+    bool prepare(const int& num_threads)
+    {
+        return true;
+    }
+    bool encode(const int& thread_id, char* src, const size_t& src_size, char* dst, size_t* dst_size);
+    size_t bound(const size_t& src_size)
+    {
+        // fpzipのヘッダ分の余裕を加えておく
+        return (size_t)(src_size*1.2)+1024;
+    }
+    size_t unit(void)
+    {
+        return (dp ? 8 : 4)*vlen;
+    }
 
 private:
     int dp;
@@ -147,20 +307,147 @@ private:
 };
 
 //! RLEアルゴリズムによる圧縮機能を提供する具象デコレータ
-class RLEEncoder: public Encoder
+class RLEEncoder: public DeflateEncoder
 {
     friend class WriteFactory;
-    explicit RLEEncoder(Write* arg) : Encoder(arg){}
+    explicit RLEEncoder(Write* arg) : DeflateEncoder(arg, Z_RLE){}
+};
+
+//! shuffleフィルタを提供する具象デコレータ
+//
+//データを要素のByte毎に並べ替えて、後段の圧縮が効きやすい形にする
+//圧縮は行わないので、zip等と組み合わせて使うこと
+class ShuffleEncoder: public Encoder
+{
+    friend class WriteFactory;
+    explicit ShuffleEncoder(Write* arg, const size_t& arg_size_of_type) : Encoder(arg),
+        size_of_type(arg_size_of_type){}
+
+public:
+    ssize_t write(const char* filename, const size_t& original_size, const size_t& actual_size, char* data);
+
+private:
+    size_t size_of_type;
+};
+
+//! bitshuffleフィルタを提供する具象デコレータ
+//
+//データを要素のビットの桁毎に並べ替えて、後段の圧縮が効きやすい形にする
+//圧縮は行わないので、zip等と組み合わせて使うこと
+class BitShuffleEncoder: public Encoder
+{
+    friend class WriteFactory;
+    explicit BitShuffleEncoder(Write* arg, const size_t& arg_size_of_type) : Encoder(arg),
+        size_of_type(arg_size_of_type){}
 
 public:
-    int write(const char* filename, const size_t& original_size, const size_t& actual_size, char* data);
+    ssize_t write(const char* filename, const size_t& original_size, const size_t& actual_size, char* data);
+
+private:
+    size_t size_of_type;
+};
+
+//! delta + varint符号化を提供する具象デコレータ
+//
+//ID等の単調に増加する整数型コンテナ向け
+//整数型(INT32, uINT32, INT64, uINT64)以外のコンテナに対しては使わないこと
+class DeltaEncoder: public Encoder
+{
+    friend class WriteFactory;
+    explicit DeltaEncoder(Write* arg, const size_t& arg_size_of_type, const int& arg_stride) : Encoder(arg),
+        size_of_type(arg_size_of_type),
+        stride(arg_stride > 0 ? arg_stride : 1){}
+
+public:
+    ssize_t write(const char* filename, const size_t& original_size, const size_t& actual_size, char* data);
+
+private:
+    size_t size_of_type;
+    size_t stride;
+};
+
+//! 誤差保証付きの非可逆量子化を提供する具象デコレータ
+//
+//FLOAT, DOUBLE型のコンテナ向け
+//量子化のみで圧縮は行わないので、zip等と組み合わせて使うこと
+class QuantizeEncoder: public Encoder
+{
+    friend class WriteFactory;
+    explicit QuantizeEncoder(Write* arg, const size_t& arg_size_of_type, const double& arg_tolerance, const bool& arg_relative) : Encoder(arg),
+        size_of_type(arg_size_of_type),
+        tolerance(arg_tolerance),
+        relative(arg_relative){}
+
+public:
+    ssize_t write(const char* filename, const size_t& original_size, const size_t& actual_size, char* data);
+
+private:
+    size_t size_of_type;
+    double tolerance;
+    bool   relative;
+};
+
+//! 直前の出力との差分を出力するtemporal符号化を提供する具象デコレータ
+//
+//interval回に1回はキーフレームとしてデータをそのまま出力し、それ以外の時は
+//直前にwriteしたデータとのXORを出力する
+//データサイズが直前の出力と異なる時は必ずキーフレームを出力する
+//
+//要素の並び順が出力毎に変わらないことが前提なので、並び順が変わった時は
+//オブジェクトを作り直して次の出力をキーフレームにすること
+class TemporalEncoder: public Encoder
+{
+    friend class WriteFactory;
+    explicit TemporalEncoder(Write* arg, const int& arg_interval) : Encoder(arg),
+        interval(arg_interval > 0 ? arg_interval : 1),
+        num_frames(0),
+        prev(NULL),
+        prev_size(0),
+        prev_capacity(0){}
+
+public:
+    ~TemporalEncoder()
+    {
+        delete[] prev;
+    }
+    ssize_t write(const char* filename, const size_t& original_size, const size_t& actual_size, char* data);
+
+private:
+    int         interval;       //< キーフレームを出力する間隔
+    int         num_frames;     //< 直前のキーフレームから数えた出力回数
+    char*       prev;           //< 直前にwriteしたデータ
+    size_t      prev_size;
+    size_t      prev_capacity;
+    std::string prev_filename;  //< 直前の出力先ファイル名
 };
 
 //! Writeクラス用シンプルファクトリ
 class WriteFactory
 {
 public:
-    static Write* create(const std::string& decorator, const std::string& type, const int& NumComp, const bool& text_flag = false, const char& delimiter = ',');
+    //! toleranceはdecoratorにquantize(絶対誤差)またはquantize_rel(相対誤差)が指定された時の許容誤差
+    //! keyframe_intervalはdecoratorにtemporalが指定された時にキーフレームを出力する間隔
+    //! backendはバイナリファイルの出力方法
+    //!   "stream" : std::ofstream (WriteBinaryFile)
+    //!   "posix"  : writev (WritePosixFile)
+    //!   "direct" : writev + 大きなファイルはO_DIRECT (WritePosixFile)
+    static Write* create(const std::string& decorator, const std::string& type, const int& NumComp, const bool& text_flag = false, const char& delimiter = ',', const double& tolerance = 0.0, const int& keyframe_interval = 10, const std::string& backend = "stream");
+
+    //! comm内の全Rankで1つのファイルを共有して出力するWriteオブジェクトを生成する
+    static Write* create(const std::string& decorator, const std::string& type, const int& NumComp, const MPI_Comm& comm, const double& tolerance = 0.0, const int& keyframe_interval = 10);
+
+    //! ファイルの代わりにblockにエンコード済のデータを出力するWriteオブジェクトを生成する
+    static Write* create(const std::string& decorator, const std::string& type, const int& NumComp, MemoryBlock* block, const double& tolerance = 0.0, const int& keyframe_interval = 10);
+
+private:
+    //! decoratorで指定された内容にしたがってwriterにEncoderを追加する
+    static Write* add_encoders(Write* writer, const std::string& decorator, const std::string& type, const int& NumComp, const double& tolerance, const int& keyframe_interval);
+
+    //! typeで指定されたデータ型のサイズ（Byte)を返す
+    static size_t size_of(const std::string& type);
+
+    //! typeで指定されたデータ型が整数型かどうかを判定する
+    static bool is_integer(const std::string& type);
 };
 }
 #endif
@@ -18,3 +18,9 @@ mpirun -np 2 ../bin/MigrationTest
 mpirun -np 1 ../bin/MigrationTest
 mpirun -np 2 ../bin/MigrationTest
 mpirun -np 1 ../bin/MigrationTest
+mpirun -np 2 ../bin/RebalanceTest
+mpirun -np 2 ../bin/AsyncWriteTest
+mpirun -np 2 ../bin/BufferingTest
+mpirun -np 2 ../bin/BufferingTest
+mpirun -np 3 ../bin/RedistributedReadTest
+mpirun -np 2 ../bin/RedistributedReadTest
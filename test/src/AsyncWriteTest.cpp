@@ -0,0 +1,166 @@
+/*
+ * PDMlib - Particle Data Management library
+ *
+ *
+ * Copyright (c) 2014 Advanced Institute for Computational Science, RIKEN.
+ * All rights reserved.
+ *
+ */
+
+/*
+ * SetAsyncWrite(), Wait(), Test()のテスト
+ *
+ *   PDMlibのインスタンスはプロセス内で1つなので、UnitTestとは別の実行ファイルにしている
+ *   mpirun -np 2 以上で実行すること
+ */
+#include <mpi.h>
+#include <cmath>
+#include <string>
+#include "gtest/gtest.h"
+#include "PDMlib.h"
+#include "MetaData.h"
+#include "TimeSliceIndex.h"
+#include "Read.h"
+
+namespace
+{
+//! 出力されたフィールドデータをデコードしてdataに読み込み、要素数を返す
+template<typename T>
+size_t ReadFieldData(const std::string& filename, const std::string& compression, const std::string& type, T** data)
+{
+    BaseIO::Read* reader        = BaseIO::ReadFactory::create(filename, compression, type, 1);
+    size_t        original_size = 0;
+    char*         buff          = NULL;
+    ssize_t       read_size     = reader->read(original_size, &buff);
+    delete reader;
+    *data = (T*)buff;
+    return read_size > 0 ? read_size/sizeof(T) : 0;
+}
+
+//! Rank, タイムステップ毎に値が異なり、圧縮にある程度時間がかかるデータ
+double Value(const int& rank, const int& step, const size_t& i)
+{
+    return std::sin(0.001*i*(rank+1))+step;
+}
+}
+
+TEST(AsyncWriteTest, write_wait_test)
+{
+    int my_rank, num_procs;
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_procs);
+
+    const std::string dfi_filename("AsyncWriteTest.dfi");
+    PDMlib::PDMlib&   pdmlib = PDMlib::PDMlib::GetInstance();
+    pdmlib.Init(0, NULL, dfi_filename);
+    pdmlib.SetBaseFileName("AsyncWriteTest");
+    PDMlib::ContainerInfo value = {"Value", "N/A", "zip",  PDMlib::DOUBLE, "value", 1};
+    PDMlib::ContainerInfo id    = {"ID",    "N/A", "none", PDMlib::INT64,  "id",    1};
+    pdmlib.AddContainer(value);
+    pdmlib.AddContainer(id);
+    pdmlib.SetAsyncWrite(true);
+
+    // I/Oスレッドでの圧縮がWrite()内のコピーより十分に長くかかるサイズにする
+    const size_t n         = 1<<21;
+    const int    num_steps = 3;
+    double*      v         = new double[n];
+    long*        ids       = new long[n];
+    for(int step = 0; step < num_steps; step++)
+    {
+        for(size_t i = 0; i < n; i++)
+        {
+            v[i]   = Value(my_rank, step, i);
+            ids[i] = my_rank*n+i+step;
+        }
+        EXPECT_EQ((int)(n*sizeof(double)), pdmlib.Write("Value", n, v,   (double*)NULL, 1, step, 0.5*step));
+        EXPECT_EQ((int)(n*sizeof(long)),   pdmlib.Write("ID",    n, ids, (long*)NULL,   1, step, 0.5*step));
+
+        // Write()はデータをコピーした時点で戻るので、まだ出力は完了していない
+        EXPECT_FALSE(pdmlib.Test("Value"));
+        EXPECT_FALSE(pdmlib.Test());
+
+        // Write()から戻った後にユーザの領域を書き換えても出力には影響しない
+        for(size_t i = 0; i < n; i++)
+        {
+            v[i]   = -1;
+            ids[i] = -1;
+        }
+
+        pdmlib.Wait("Value");
+        EXPECT_TRUE(pdmlib.Test("Value"));
+    }
+    pdmlib.Wait();
+    EXPECT_TRUE(pdmlib.Test());
+
+    // 出力バッファの設定変更は、非同期出力が完了してから行われる
+    for(size_t i = 0; i < n; i++)
+    {
+        v[i] = Value(my_rank, num_steps, i);
+    }
+    pdmlib.Write("Value", n, v, (double*)NULL, 1, num_steps, 0.5*num_steps);
+    pdmlib.SetMaxBufferingTime(0);
+    EXPECT_TRUE(pdmlib.Test());
+    delete[] v;
+    delete[] ids;
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    // Wait()の後は、DFIファイルの内容どおりにフィールドデータが出力されている
+    PDMlib::MetaData meta_data(dfi_filename);
+    ASSERT_EQ(0, meta_data.Read());
+    PDMlib::ContainerInfo container_info;
+    meta_data.GetContainerInfo("Value", &container_info);
+    EXPECT_EQ("zip", container_info.Compression);
+    for(int step = 0; step <= num_steps; step++)
+    {
+        std::string filename;
+        meta_data.GetFileName(&filename, "Value", my_rank, step);
+        double*     read_v = NULL;
+        ASSERT_EQ(n, ReadFieldData(filename, "zip", "double", &read_v));
+        size_t      num_mismatch = 0;
+        for(size_t i = 0; i < n; i++)
+        {
+            if(read_v[i] != Value(my_rank, step, i)) num_mismatch++;
+        }
+        EXPECT_EQ((size_t)0, num_mismatch);
+        delete[] (char*)read_v;
+
+        if(step == num_steps) break;
+        meta_data.GetFileName(&filename, "ID", my_rank, step);
+        long*       read_ids = NULL;
+        ASSERT_EQ(n, ReadFieldData(filename, "", "long", &read_ids));
+        num_mismatch = 0;
+        for(size_t i = 0; i < n; i++)
+        {
+            if(read_ids[i] != (long)(my_rank*n+i+step)) num_mismatch++;
+        }
+        EXPECT_EQ((size_t)0, num_mismatch);
+        delete[] (char*)read_ids;
+    }
+
+    // 全Rankのタイムスライス情報がインデックスに揃っている
+    // 最後のタイムステップはIDを出力していないので、まだインデックスには書き込まれない
+    if(my_rank == 0)
+    {
+        PDMlib::TimeSliceIndex::Reader reader;
+        ASSERT_TRUE(reader.load(PDMlib::TimeSliceIndex::filename(dfi_filename)));
+        ASSERT_EQ((size_t)num_procs, reader.get_num_procs());
+        ASSERT_EQ((size_t)num_steps, reader.size());
+        const int value_index = reader.container_index("Value");
+        const int id_index    = reader.container_index("ID");
+        ASSERT_LE(0, value_index);
+        ASSERT_LE(0, id_index);
+        for(int step = 0; step < num_steps; step++)
+        {
+            EXPECT_TRUE(reader.is_complete(step));
+            EXPECT_EQ(step, reader.time_step(step));
+            EXPECT_DOUBLE_EQ(0.5*step, reader.time(step));
+            EXPECT_EQ((uint64_t)n*num_procs, reader.total_particles(step, value_index));
+            for(int rank = 0; rank < num_procs; rank++)
+            {
+                EXPECT_EQ((uint64_t)n, reader.num_particles(step, value_index, rank));
+                EXPECT_LT(0u, reader.num_bytes(step, value_index, rank));
+                EXPECT_EQ((uint64_t)n*sizeof(long), reader.num_bytes(step, id_index, rank));
+            }
+        }
+    }
+}
@@ -0,0 +1,201 @@
+/*
+ * PDMlib - Particle Data Management library
+ *
+ *
+ * Copyright (c) 2014 Advanced Institute for Computational Science, RIKEN.
+ * All rights reserved.
+ *
+ */
+
+/*
+ * 出力バッファリング(SetBufferSize(), SetMaxBufferingTime(), Flush())のテスト
+ *
+ *   PDMlibのインスタンスはプロセス内で1つなので、UnitTestとは別の実行ファイルにしている
+ *   デストラクタでの出力は次回の実行時に確認するので、同じディレクトリで2回以上続けて実行すること
+ *   mpirun -np 2 以上で実行すること
+ */
+#include <mpi.h>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "gtest/gtest.h"
+#include "PDMlib.h"
+#include "TimeSliceIndex.h"
+#include "Read.h"
+#include "Utility.h"
+#include "FileUtils.h"
+
+namespace
+{
+const std::string dfi_filename("BufferingTest.dfi");
+const size_t      num_particles = 1<<16; // 1回の出力で512KiB
+const int         last_step     = 5;     // デストラクタで出力されるタイムステップ
+
+//! Rank毎のフィールドデータのファイル名（デフォルトのpdm/ベースファイル名_Rank_タイムステップ.拡張子）
+std::string FieldFileName(const int& rank, const int& step)
+{
+    std::ostringstream oss;
+    oss<<"pdm/BufferingTest_"<<rank<<"_"<<step<<".value";
+    return oss.str();
+}
+
+//! 全Rankが揃った時点でインデックスに記録されているタイムステップの一覧
+std::vector<int> CompleteSteps(void)
+{
+    MPI_Barrier(MPI_COMM_WORLD);
+    std::vector<int>               steps;
+    PDMlib::TimeSliceIndex::Reader reader;
+    if(reader.load(PDMlib::TimeSliceIndex::filename(dfi_filename)))
+    {
+        reader.complete_steps(&steps);
+    }
+    // 確認が終わるまで他のRankに次の出力をさせない
+    MPI_Barrier(MPI_COMM_WORLD);
+    return steps;
+}
+
+//! 0からlastまでの連番
+std::vector<int> Steps(const int& last)
+{
+    std::vector<int> steps;
+    for(int i = 0; i <= last; i++)
+    {
+        steps.push_back(i);
+    }
+    return steps;
+}
+
+double Value(const int& rank, const int& step, const size_t& i)
+{
+    return 1000*rank+step+0.5*i;
+}
+}
+
+// 前回の実行でバッファに残したまま終了したタイムステップが、デストラクタで出力されている
+// 次のテストで出力し直すので、このテストを先に実行すること
+TEST(BufferingTest, flushed_in_destructor)
+{
+    int my_rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    // 以降の集団通信で止まらないように、どこかのRankに前回の出力があれば全Rankで確認する
+    int has_output = PDMlib::isFile(FieldFileName(my_rank, 0)) ? 1 : 0;
+    MPI_Allreduce(MPI_IN_PLACE, &has_output, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    if(has_output == 0)
+    {
+        std::cerr<<"BufferingTest: no output from the previous run, skip checking Flush() in destructor"<<std::endl;
+        return;
+    }
+
+    std::vector<int> steps = CompleteSteps();
+    EXPECT_EQ(Steps(last_step), steps);
+
+    PDMlib::TimeSliceIndex::Reader reader;
+    if(reader.load(PDMlib::TimeSliceIndex::filename(dfi_filename)) && reader.size() > 0)
+    {
+        const long record = reader.find(last_step);
+        EXPECT_LE(0, record);
+        if(record >= 0)
+        {
+            EXPECT_EQ((uint64_t)num_particles, reader.num_particles(record, 0, my_rank));
+            EXPECT_EQ((uint64_t)num_particles*sizeof(double), reader.num_bytes(record, 0, my_rank));
+        }
+    }
+
+    BaseIO::Read* file_reader   = BaseIO::ReadFactory::create(FieldFileName(my_rank, last_step), "", "double", 1);
+    size_t        original_size = 0;
+    double*       data          = NULL;
+    EXPECT_EQ((ssize_t)(num_particles*sizeof(double)), file_reader->read(original_size, (char**)&data));
+    delete file_reader;
+    if(data != NULL)
+    {
+        size_t num_mismatch = 0;
+        for(size_t i = 0; i < num_particles; i++)
+        {
+            if(data[i] != Value(my_rank, last_step, i)) num_mismatch++;
+        }
+        EXPECT_EQ((size_t)0, num_mismatch);
+        delete[] (char*)data;
+    }
+}
+
+TEST(BufferingTest, flush)
+{
+    int my_rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    for(int step = 0; step <= last_step; step++)
+    {
+        FileUtils::RemoveFile(FieldFileName(my_rank, step));
+    }
+
+    PDMlib::PDMlib& pdmlib = PDMlib::PDMlib::GetInstance();
+    pdmlib.Init(0, NULL, dfi_filename);
+    pdmlib.SetBaseFileName("BufferingTest");
+    PDMlib::ContainerInfo value = {"Value", "N/A", "none", PDMlib::DOUBLE, "value", 1};
+    pdmlib.AddContainer(value);
+
+    double* v = new double[num_particles];
+    for(int step = 0; step <= last_step; step++)
+    {
+        // step 0-2 : 回数によるバッファリング
+        // step 3-4 : サイズによるバッファリング
+        // step 5   : バッファに残したままデストラクタで出力させる
+        if(step == 0)
+        {
+            pdmlib.SetMaxBufferingTime(2);
+        }else if(step == 3){
+            pdmlib.SetMaxBufferingTime(0);
+            pdmlib.SetBufferSize(1);
+        }
+
+        for(size_t i = 0; i < num_particles; i++)
+        {
+            v[i] = Value(my_rank, step, i);
+        }
+        // バッファリング中はエンコード後のデータサイズが返る
+        EXPECT_EQ((int)(num_particles*sizeof(double)), pdmlib.Write("Value", num_particles, v, (double*)NULL, 1, step, 0.1*step));
+
+        std::vector<int> steps = CompleteSteps();
+        if(step == 0)
+        {
+            // バッファ内のデータはファイルにもインデックスにも出力されない
+            EXPECT_TRUE(steps.empty());
+            EXPECT_FALSE(PDMlib::isFile(FieldFileName(my_rank, 0)));
+        }else if(step == 1){
+            EXPECT_TRUE(steps.empty());
+        }else if(step == 2){
+            // MaxBufferingTime回分が溜まった状態で次のタイムステップが来たので、それまでの分を出力する
+            EXPECT_EQ(Steps(1), steps);
+            EXPECT_TRUE(PDMlib::isFile(FieldFileName(my_rank, 1)));
+            EXPECT_FALSE(PDMlib::isFile(FieldFileName(my_rank, 2)));
+
+            // Flush()するとバッファ内のタイムステップもインデックスに記録される
+            pdmlib.Flush();
+            EXPECT_EQ(Steps(2), CompleteSteps());
+            EXPECT_TRUE(PDMlib::isFile(FieldFileName(my_rank, 2)));
+        }else if(step == 3){
+            // BufferSizeに達するまでは出力しない
+            EXPECT_EQ(Steps(2), steps);
+            EXPECT_FALSE(PDMlib::isFile(FieldFileName(my_rank, 3)));
+        }else if(step == 4){
+            // BufferSize(1MiB)に達した時点で出力する
+            EXPECT_EQ(Steps(4), steps);
+            EXPECT_TRUE(PDMlib::isFile(FieldFileName(my_rank, 4)));
+        }else{
+            EXPECT_EQ(Steps(4), steps);
+            EXPECT_FALSE(PDMlib::isFile(FieldFileName(my_rank, last_step)));
+        }
+    }
+    delete[] v;
+
+    // 出力済のタイムステップのRank毎の粒子数と出力サイズ
+    PDMlib::TimeSliceIndex::Reader reader;
+    ASSERT_TRUE(reader.load(PDMlib::TimeSliceIndex::filename(dfi_filename)));
+    for(int step = 0; step < last_step; step++)
+    {
+        const long record = reader.find(step);
+        ASSERT_LE(0, record);
+        EXPECT_DOUBLE_EQ(0.1*step, reader.time(record));
+        EXPECT_EQ((uint64_t)num_particles, reader.num_particles(record, 0, my_rank));
+        EXPECT_EQ((uint64_t)num_particles*sizeof(double), reader.num_bytes(record, 0, my_rank));
+    }
+}
@@ -10,59 +10,447 @@
 #include <vector>
 #include <iostream>
 #include <sstream>
+#include <fstream>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <zlib.h>
 #include "gtest/gtest.h"
 #include "FileUtils.h"
 #include "TestDataGenerator.h"
 #include "Read.h"
 #include "Write.h"
+#include "PosixIO.h"
+#include "Temporal.h"
+#include "Utility.h"
+#include "ChunkIndex.h"
 
+// エンコード/デコードのテスト
 // パラメータに指定する値
-//   1:テストデータの種類(sequential, random, or same)
-//   2:Encode/Decodeの種類
-class EncodeDecodeTest: public ::testing::TestWithParam<std::tr1::tuple<std::string, std::string> >
+//   1:Encode/Decodeの種類
+//   2:テストデータの種類(sequential, random, same, or sequential_vector)
+//   3:データ型(double, or INT64 INT64は3成分のベクトルとして出力する)
+//   4:要素数
+//   5:出力/入力の方法("出力:入力"の形式  sharedの時は全Rankで1つのファイルを共有する)
+typedef std::tr1::tuple<std::string, std::string, std::string, int, std::string> EncodeDecodeParam;
+
+class EncodeDecodeTest: public ::testing::TestWithParam<EncodeDecodeParam>
 {
 protected:
-    EncodeDecodeTest(): length(1000)
+    EncodeDecodeTest(): codec(std::tr1::get<0>(GetParam())),
+        type(std::tr1::get<2>(GetParam())),
+        length(std::tr1::get<3>(GetParam())),
+        shared(std::tr1::get<4>(GetParam()) == "shared"),
+        tolerance(1.0e-3)
     {
-        data   = TestDataGenerator<double>::create(length, std::tr1::get<1>(GetParam()));
-        writer = BaseIO::WriteFactory::create(std::tr1::get<0>(GetParam()), "double", 1);
+        MPI_Comm_rank(MPI_COMM_WORLD, &myrank);
+        const std::string& category = std::tr1::get<1>(GetParam());
+        const std::string& backend  = std::tr1::get<4>(GetParam());
+        const unsigned int seed     = shared ? myrank+1 : 1;
+        if(type == "INT64")
+        {
+            create_data<long>(category, seed);
+        }else{
+            create_data<double>(category, seed);
+        }
+
+        // 共有ファイル以外はRank毎に別のファイルに出力する
         std::ostringstream oss;
-        oss<<length;
-        filename = std::tr1::get<0>(GetParam())+"_"+std::tr1::get<1>(GetParam())+"_"+oss.str()+".bin";
-        writer->write(filename.c_str(), length*sizeof(double), length*sizeof(double), (char*)(data));
-        reader = BaseIO::ReadFactory::create(filename, std::tr1::get<0>(GetParam()), "double", 1);
+        oss<<codec<<"_"<<category<<"_"<<type<<"_"<<length<<"_"<<backend;
+        if(!shared) oss<<"_"<<myrank;
+        filename = oss.str()+".bin";
+        std::replace(filename.begin(), filename.end(), ':', '_');
+
+        const int nComp = type == "INT64" ? 3 : 1;
+        if(shared)
+        {
+            writer = BaseIO::WriteFactory::create(codec, type, nComp, MPI_COMM_WORLD, tolerance);
+            writer->write(filename.c_str(), data.size(), data.size(), &(data[0]));
+            reader = BaseIO::ReadFactory::create(filename, codec, type, nComp, myrank);
+        }else{
+            const size_t separator = backend.find(':');
+            writer = BaseIO::WriteFactory::create(codec, type, nComp, false, ',', tolerance, 10, backend.substr(0, separator));
+            writer->write(filename.c_str(), data.size(), data.size(), &(data[0]));
+            reader = BaseIO::ReadFactory::create(filename, codec, type, nComp, -1, backend.substr(separator+1));
+        }
     }
 
     ~EncodeDecodeTest()
     {
-        delete data;
         delete writer;
         delete reader;
     }
 
-    double*        data;
-    BaseIO::Read*  reader;
-    BaseIO::Write* writer;
-    std::string    filename;
-    const int      length;
+    template<typename T>
+    void create_data(const std::string& category, const unsigned int& seed)
+    {
+        T* values = TestDataGenerator<T>::create(length, category, seed);
+        data.assign((char*)values, (char*)(values+length));
+        delete[] values;
+    }
+
+    //! 元のデータと値が異なる要素数を返す
+    //
+    //quantizeの時は許容誤差を越える要素数を返す
+    //quantize_relの時の許容誤差はデータの範囲(0-length)に対する相対誤差
+    size_t count_mismatch(const char* read_data) const
+    {
+        if(type == "INT64")
+        {
+            return count_mismatch((const long*)&(data[0]), (const long*)read_data, 0.0);
+        }
+        double bound = 0.0;
+        if(codec.find("quantize_rel") != std::string::npos)
+        {
+            bound = tolerance*length;
+        }else if(codec.find("quantize") != std::string::npos){
+            bound = tolerance;
+        }
+        return count_mismatch((const double*)&(data[0]), (const double*)read_data, bound);
+    }
+
+    template<typename T>
+    size_t count_mismatch(const T* expected, const T* actual, const double& bound) const
+    {
+        size_t num_mismatch = 0;
+        for(int i = 0; i < length; i++)
+        {
+            if(bound > 0.0 ? std::fabs((double)expected[i]-(double)actual[i]) > bound : expected[i] != actual[i])
+            {
+                num_mismatch++;
+            }
+        }
+        return num_mismatch;
+    }
+
+    const std::string codec;
+    const std::string type;
+    const int         length;
+    const bool        shared;
+    const double      tolerance;
+    int               myrank;
+    std::vector<char> data;
+    BaseIO::Read*     reader;
+    BaseIO::Write*    writer;
+    std::string       filename;
 };
 
 TEST_P(EncodeDecodeTest, read)
 {
-    double* read_data;
-    size_t  tmp_size;
-        EXPECT_EQ(length*sizeof(double), reader->read(tmp_size, (char**)&read_data));
+    char*  read_data;
+    size_t tmp_size;
+    EXPECT_EQ(data.size(), reader->read(tmp_size, &read_data));
+    EXPECT_EQ(0, count_mismatch(read_data));
+    delete[] read_data;
+}
 
-    for(int i = 0; i < length; i++)
+// ヘッダを先に読んでサイズを求め、確保済の領域に直接読み込む
+TEST_P(EncodeDecodeTest, read_into)
+{
+    size_t original_size = 0;
+    EXPECT_EQ(1, reader->read_header(original_size));
+    EXPECT_EQ(data.size(), original_size);
+
+    char*  read_data = new char[original_size];
+    size_t tmp_size;
+    EXPECT_EQ(data.size(), reader->read_into(tmp_size, read_data, original_size));
+    EXPECT_EQ(0, count_mismatch(read_data));
+    delete[] read_data;
+}
+
+// 無圧縮の時は、ヘッダの後ろのデータをmmapしてそのまま参照できる
+// 共有ファイル内のデータは要素のサイズの境界から始まる
+TEST_P(EncodeDecodeTest, raw_extent)
+{
+    size_t original_size = 0;
+    EXPECT_EQ(1, reader->read_header(original_size));
+
+    std::string extent_filename;
+    size_t      offset = 0;
+    size_t      size   = 0;
+    const bool  raw    = reader->get_raw_extent(extent_filename, offset, size);
+    if(codec == "none")
     {
-        EXPECT_EQ(data[i], read_data[i]);
+        EXPECT_TRUE(raw);
+    }
+    if(!raw) return;
+    EXPECT_EQ(filename, extent_filename);
+    if(shared)
+    {
+        EXPECT_EQ(0, offset%(data.size()/length));
     }
-    delete (char*)read_data;
+    EXPECT_EQ(data.size(), size);
+
+    void*       map_base;
+    size_t      map_size;
+    const char* mapped = BaseIO::PosixIO::map_file(extent_filename.c_str(), offset, size, &map_base, &map_size);
+    ASSERT_TRUE(mapped != NULL);
+    EXPECT_EQ(0, memcmp(&(data[0]), mapped, size));
+    BaseIO::PosixIO::unmap_file(map_base, map_size);
 }
 
 INSTANTIATE_TEST_CASE_P(AllTest, EncodeDecodeTest,
                         ::testing::Combine(
-                            ::testing::Values("none", "zip", "fpzip", "RLE", "zip+rLe", "RLE+ZIP"),
-                            ::testing::Values("sequential", "random", "same")
+                            ::testing::Values("none", "zip", "fpzip", "RLE", "zip+rLe", "RLE+ZIP", "shuffle-zip", "bitshuffle-zip", "zip-Shuffle", "shuffle"),
+                            ::testing::Values("sequential", "random", "same"),
+                            ::testing::Values("double"),
+                            ::testing::Values(1000),
+                            ::testing::Values("stream:stream")
+                            )
+                        );
+
+// 整数型データに対するdelta符号化のテスト
+INSTANTIATE_TEST_CASE_P(Delta, EncodeDecodeTest,
+                        ::testing::Combine(
+                            ::testing::Values("delta", "delta-zip", "zip-delta", "delta-RLE"),
+                            ::testing::Values("sequential", "random", "same", "sequential_vector"),
+                            ::testing::Values("INT64"),
+                            ::testing::Values(999),
+                            ::testing::Values("stream:stream")
+                            )
+                        );
+
+// 非可逆量子化のテスト
+INSTANTIATE_TEST_CASE_P(Quantize, EncodeDecodeTest,
+                        ::testing::Combine(
+                            ::testing::Values("quantize", "quantize-zip", "zip-quantize_rel", "quantize-shuffle-zip"),
+                            ::testing::Values("sequential", "random", "same"),
+                            ::testing::Values("double"),
+                            ::testing::Values(1000),
+                            ::testing::Values("stream:stream")
+                            )
+                        );
+
+// 複数チャンクに分割されるサイズのデータに対するテスト
+INSTANTIATE_TEST_CASE_P(Chunked, EncodeDecodeTest,
+                        ::testing::Combine(
+                            ::testing::Values("zip", "fpzip", "RLE", "zip+rLe", "bitshuffle-zip"),
+                            ::testing::Values("sequential", "random", "same"),
+                            ::testing::Values("double"),
+                            ::testing::Values(1500000),
+                            ::testing::Values("stream:stream")
+                            )
+                        );
+
+// 出力/入力の方法(stream, posix, direct)を組み合わせても同じデータが読めることを確認する
+INSTANTIATE_TEST_CASE_P(IOBackend, EncodeDecodeTest,
+                        ::testing::Combine(
+                            ::testing::Values("none", "zip", "shuffle-zip"),
+                            ::testing::Values("random"),
+                            ::testing::Values("double"),
+                            ::testing::Values(1000),
+                            ::testing::Values("stream:stream", "stream:posix", "stream:direct",
+                                              "posix:stream",  "posix:posix",  "posix:direct",
+                                              "direct:stream", "direct:posix", "direct:direct")
+                            )
+                        );
+
+// 共有ファイル出力/入力のテスト
+INSTANTIATE_TEST_CASE_P(SharedFile, EncodeDecodeTest,
+                        ::testing::Combine(
+                            ::testing::Values("none", "zip", "RLE"),
+                            ::testing::Values("sequential", "random", "same"),
+                            ::testing::Values("double"),
+                            ::testing::Values(1000),
+                            ::testing::Values("shared")
+                            )
+                        );
+
+// temporal符号化のテスト
+// 同じWriteオブジェクトで少しずつ値を変えたデータを複数回出力し、全てのステップが復元できることを確認する
+// パラメータに指定する値
+//   1:Encode/Decodeの種類
+//   2:ファイルの配置(flat: 全ステップ同じディレクトリ, sharded: ステップ毎のディレクトリ）
+class TemporalEncodeDecodeTest: public ::testing::TestWithParam<std::tr1::tuple<std::string, std::string> >
+{
+protected:
+    TemporalEncodeDecodeTest(): length(1000), num_steps(7), keyframe_interval(3)
+    {
+        BaseIO::Write* writer = BaseIO::WriteFactory::create(std::tr1::get<0>(GetParam()), "double", 1, false, ',', 0.0, keyframe_interval);
+        for(int step = 0; step < num_steps; step++)
+        {
+            double* data = TestDataGenerator<double>::create(length, "sequential");
+            for(int i = 0; i < length; i += 7)
+            {
+                data[i] += 0.01*step;
+            }
+            PDMlib::RecursiveMkdir(get_dirname(step));
+            writer->write(get_filename(step).c_str(), length*sizeof(double), length*sizeof(double), (char*)(data));
+            steps.push_back(data);
+        }
+        delete writer;
+    }
+
+    ~TemporalEncodeDecodeTest()
+    {
+        for(std::vector<double*>::iterator it = steps.begin(); it != steps.end(); ++it)
+        {
+            delete[] *it;
+        }
+    }
+
+    //! sharded形式と同じく、ステップ毎のディレクトリの下にRankグループのディレクトリを作る
+    //
+    //他のRankと同じファイルに出力しないように、最上位のディレクトリ名にRank番号を付ける
+    std::string get_dirname(const int& step)
+    {
+        int myrank;
+        MPI_Comm_rank(MPI_COMM_WORLD, &myrank);
+        std::ostringstream oss;
+        oss<<"temporal_"<<std::tr1::get<1>(GetParam())<<"_"<<myrank;
+        if(std::tr1::get<1>(GetParam()) == "sharded")
+        {
+            oss<<"/"<<std::tr1::get<0>(GetParam())<<"_step_"<<step<<"/r0000-0001";
+        }
+        return oss.str();
+    }
+
+    std::string get_filename(const int& step)
+    {
+        std::ostringstream oss;
+        oss<<get_dirname(step)<<"/temporal_"<<std::tr1::get<0>(GetParam())<<"_"<<step<<".bin";
+        return oss.str();
+    }
+
+    std::vector<double*> steps;
+    const int            length;
+    const int            num_steps;
+    const int            keyframe_interval;
+};
+
+TEST_P(TemporalEncodeDecodeTest, read)
+{
+    for(int step = num_steps-1; step >= 0; step--)
+    {
+        BaseIO::Read* reader = BaseIO::ReadFactory::create(get_filename(step), std::tr1::get<0>(GetParam()), "double", 1);
+        double*       read_data;
+        size_t        tmp_size;
+        EXPECT_EQ(length*sizeof(double), reader->read(tmp_size, (char**)&read_data));
+        for(int i = 0; i < length; i++)
+        {
+            EXPECT_EQ(steps[step][i], read_data[i]);
+        }
+        delete[] (char*)read_data;
+        delete reader;
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(AllTest, TemporalEncodeDecodeTest,
+                        ::testing::Combine(
+                            ::testing::Values("temporal", "temporal-zip", "shuffle-temporal-zip", "zip-temporal-RLE"),
+                            ::testing::Values("flat", "sharded")
                             )
                         );
+
+TEST(TemporalRelativePathTest, ok)
+{
+    EXPECT_EQ("foo_0_1.x", BaseIO::Temporal::relative_path("pdm/foo_0_2.x", "pdm/foo_0_1.x"));
+    EXPECT_EQ("../../foo_step_000001/r0000-0001/foo_0_1.x",
+              BaseIO::Temporal::relative_path("pdm/foo_step_000002/r0000-0001/foo_0_2.x", "pdm/foo_step_000001/r0000-0001/foo_0_1.x"));
+    EXPECT_EQ("foo_0_1.x", BaseIO::Temporal::relative_path("foo_0_2.x", "foo_0_1.x"));
+}
+
+// チャンク分割を導入する前の形式（全体で1つのzlibストリーム）のファイルが読めることを確認する
+TEST(LegacyFormatTest, zip)
+{
+    const int length = 1000;
+    double*   data   = TestDataGenerator<double>::create(length, "sequential");
+    uLongf    compressed_size = compressBound(length*sizeof(double));
+    char*     compressed      = new char[compressed_size];
+    ASSERT_EQ(Z_OK, compress((Bytef*)compressed, &compressed_size, (Bytef*)data, length*sizeof(double)));
+
+    int myrank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &myrank);
+    std::ostringstream oss;
+    oss<<"legacy_zip_"<<myrank<<".bin";
+    const std::string filename = oss.str();
+
+    std::ofstream out(filename.c_str(), std::ios::binary);
+    char   size_of_int     = sizeof(int);
+    char   size_of_size_t  = sizeof(size_t);
+    int    byte_order_mark = 9615;
+    size_t original_size   = length*sizeof(double);
+    size_t actual_size     = compressed_size;
+    out.write(&size_of_int,               1);
+    out.write(&size_of_size_t,            1);
+    out.write((char*)&byte_order_mark,    sizeof(int));
+    out.write((char*)&original_size,      sizeof(size_t));
+    out.write((char*)&actual_size,        sizeof(size_t));
+    out.write(compressed,                 compressed_size);
+    out.close();
+
+    BaseIO::Read* reader = BaseIO::ReadFactory::create(filename, "zip", "double", 1);
+    double*       read_data;
+    size_t        tmp_size;
+    EXPECT_EQ(length*sizeof(double), reader->read(tmp_size, (char**)&read_data));
+    for(int i = 0; i < length; i++)
+    {
+        EXPECT_EQ(data[i], read_data[i]);
+    }
+    delete[] (char*)read_data;
+    delete reader;
+    delete[] data;
+    delete[] compressed;
+}
+
+// チャンクの位置がデータの範囲外を指すインデックスは読み込みエラーにする
+TEST(BrokenChunkIndexTest, out_of_range)
+{
+    int myrank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &myrank);
+    std::ostringstream oss;
+    oss<<"broken_chunk_index_"<<myrank<<".bin";
+    const std::string filename = oss.str();
+
+    const int      length = 1500000;
+    double*        data   = TestDataGenerator<double>::create(length, "random");
+    BaseIO::Write* writer = BaseIO::WriteFactory::create("zip", "double", 1);
+    writer->write(filename.c_str(), length*sizeof(double), length*sizeof(double), (char*)data);
+    delete writer;
+    delete[] data;
+
+    // ファイルヘッダ(22Byte)の後ろにあるインデックスの、2番目のチャンクの開始位置を書き換える
+    char broken_offset[8];
+    BaseIO::ChunkIndex::put(broken_offset, (size_t)1<<40);
+    std::fstream file(filename.c_str(), std::ios::binary|std::ios::in|std::ios::out);
+    file.seekp(22+sizeof(BaseIO::ChunkIndex::magic)+8*2);
+    file.write(broken_offset, sizeof(broken_offset));
+    file.close();
+
+    BaseIO::Read* reader = BaseIO::ReadFactory::create(filename, "zip", "double", 1);
+    char*         read_data = NULL;
+    size_t        tmp_size;
+    EXPECT_EQ(-1, reader->read(tmp_size, &read_data));
+    delete reader;
+}
+
+// O_DIRECTを使うサイズのファイルを読み書きする
+// ファイルはRank毎に別にする
+// アライメントに揃わないサイズにして、末尾のブロックの扱いを確認する
+TEST(DirectIOTest, large)
+{
+    const int      length = 64*1024*1024/sizeof(double)+123;
+    double*        data   = TestDataGenerator<double>::create(length, "random");
+    int myrank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &myrank);
+    std::ostringstream oss;
+    oss<<"backend_direct_large_"<<myrank<<".bin";
+    const std::string filename = oss.str();
+
+    BaseIO::Write* writer = BaseIO::WriteFactory::create("none", "double", 1, false, ',', 0.0, 10, "direct");
+    EXPECT_EQ(length*sizeof(double), writer->write(filename.c_str(), length*sizeof(double), length*sizeof(double), (char*)data));
+
+    const char* backends[] = {"stream", "direct"};
+    for(int b = 0; b < 2; b++)
+    {
+        BaseIO::Read* reader = BaseIO::ReadFactory::create(filename, "none", "double", 1, -1, backends[b]);
+        double*       read_data;
+        size_t        tmp_size;
+        EXPECT_EQ(length*sizeof(double), reader->read(tmp_size, (char**)&read_data));
+        EXPECT_EQ(0, memcmp(data, read_data, length*sizeof(double)));
+        delete[] (char*)read_data;
+        delete reader;
+    }
+    delete writer;
+    delete[] data;
+}
@@ -11,6 +11,7 @@
 #define private public
 #include "MetaData.h"
 #undef private
+#include "Utility.h"
 
 TEST(MetaDataTest, write)
 {
@@ -49,3 +50,86 @@ TEST(MetaDataTest, write)
       EXPECT_DOUBLE_EQ(bbox[i], bbox2[i]);
     }
 }
+
+TEST(MetaDataTest, serialize)
+{
+    PDMlib::MetaData md("MetaDataTest.txt");
+    PDMlib::UnitElem p = {"Pressure", "Pa", 2.0, 0.3, true};
+    md.AddUnit(p);
+    double bbox[6]={-1.0, -2.0, -3.0, 4.0, 5.0, 6.0};
+    md.SetBoundingBox(bbox);
+    md.SetBaseFileName("serialize");
+    md.SetFieldFileMode("shared");
+    PDMlib::ContainerInfo PV = {"ParticleVerocity", "velocity", "shuffle-zip", PDMlib::FLOAT, "vel", 3, PDMlib::IJKN};
+    PDMlib::ContainerInfo Q  = {"quantized", "", "quantize-zip", PDMlib::DOUBLE, "q", 1, PDMlib::NIJK, 0.25};
+    md.AddContainer(PV);
+    md.AddContainer(Q);
+
+    // Rank0以外のRankがRead()で受け取る内容と同じものを復元する
+    std::vector<char> buff;
+    md.Serialize(&buff);
+    PDMlib::MetaData md2("MetaDataTest.txt");
+    md2.Deserialize(buff);
+    EXPECT_TRUE(md.Compare(md2));
+    EXPECT_EQ("serialize", md2.GetBaseFileName());
+    EXPECT_TRUE(md2.is_shared_file());
+
+    double bbox2[6];
+    md2.GetBoundingBox(bbox2);
+    for (int i =0; i<6; i++)
+    {
+      EXPECT_DOUBLE_EQ(bbox[i], bbox2[i]);
+    }
+}
+
+TEST(MetaDataTest, tolerance)
+{
+    PDMlib::MetaData md("MetaDataTest.txt");
+    PDMlib::ContainerInfo Q = {"quantized", "", "quantize-zip", PDMlib::DOUBLE, "q", 1, PDMlib::NIJK, 0.25};
+    PDMlib::ContainerInfo T = {"temperature", "", "zip", PDMlib::FLOAT, "temp", 1};
+    md.AddContainer(Q);
+    md.AddContainer(T);
+    EXPECT_EQ(0, md.Write());
+
+    // Toleranceを指定したコンテナだけがDFIファイルに許容誤差を持つ
+    PDMlib::MetaData md2("MetaDataTest.txt");
+    EXPECT_EQ(0, md2.Read());
+    EXPECT_TRUE(md.Compare(md2));
+    PDMlib::ContainerInfo container_info;
+    md2.GetContainerInfo("quantized", &container_info);
+    EXPECT_DOUBLE_EQ(0.25, container_info.Tolerance);
+    md2.GetContainerInfo("temperature", &container_info);
+    EXPECT_DOUBLE_EQ(0.0, container_info.Tolerance);
+}
+
+TEST(MetaDataTest, field_file_mode_is_fixed_after_read_only)
+{
+    PDMlib::MetaData md("MetaDataTest.txt");
+    EXPECT_TRUE(md.SetFieldFileMode("shared"));
+    md.SetReadOnly();
+    EXPECT_FALSE(md.SetFieldFileMode("file_per_process"));
+    EXPECT_TRUE(md.is_shared_file());
+}
+
+TEST(MetaDataTest, sharded_file_name)
+{
+    PDMlib::MetaData md("MetaDataTest.txt");
+    PDMlib::ContainerInfo T = {"temperature", "", "zip", PDMlib::FLOAT, "temp", 1};
+    md.AddContainer(T);
+    md.SetBaseFileName("foo");
+
+    std::string filename;
+    md.GetFileName(&filename, "temperature", 300, 100);
+    EXPECT_EQ("pdm/foo_300_100.temp", filename);
+
+    md.SetDirectoryLayout("sharded", 256);
+    EXPECT_TRUE(md.is_sharded());
+    md.GetFileName(&filename, "temperature", 300, 100);
+    EXPECT_EQ("pdm/foo_step_000100/r0256-0511/foo_300_100.temp", filename);
+    EXPECT_EQ(100, PDMlib::get_time_step(filename, true));
+    EXPECT_EQ(300, PDMlib::get_region_number(filename, true));
+
+    md.SetFieldFileMode("shared");
+    md.GetFileName(&filename, "temperature", 300, 100);
+    EXPECT_EQ("pdm/foo_step_000100/foo_100.temp", filename);
+}
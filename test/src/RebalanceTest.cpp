@@ -0,0 +1,108 @@
+/*
+ * PDMlib - Particle Data Management library
+ *
+ *
+ * Copyright (c) 2014 Advanced Institute for Computational Science, RIKEN.
+ * All rights reserved.
+ *
+ */
+
+/*
+ * Rebalance()のテスト
+ *
+ *   PDMlibのインスタンスはプロセス内で1つなので、UnitTestとは別の実行ファイルにしている
+ *   mpirun -np 2 以上で実行すること
+ */
+#include <mpi.h>
+#include <cstdlib>
+#include <algorithm>
+#include "gtest/gtest.h"
+#include "PDMlib.h"
+
+TEST(RebalanceTest, load_balance_params)
+{
+    PDMlib::PDMlib& pdmlib = PDMlib::PDMlib::GetInstance();
+    EXPECT_EQ("RCB", pdmlib.GetLoadBalanceParam("LB_METHOD"));
+    EXPECT_EQ("", pdmlib.GetLoadBalanceParam("NO_SUCH_PARAM"));
+    pdmlib.SetLoadBalanceParam("IMBALANCE_TOL", "1.05");
+    EXPECT_EQ("1.05", pdmlib.GetLoadBalanceParam("IMBALANCE_TOL"));
+}
+
+TEST(RebalanceTest, repeated)
+{
+    int my_rank, num_procs;
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_procs);
+
+    PDMlib::PDMlib& pdmlib = PDMlib::PDMlib::GetInstance();
+    pdmlib.Init(0, NULL, "RebalanceTest.dfi");
+    PDMlib::ContainerInfo coordinate = {"Coordinate", "N/A", "none", PDMlib::DOUBLE, "coord", 3, PDMlib::NIJK};
+    PDMlib::ContainerInfo id         = {"ID",         "N/A", "none", PDMlib::INT64,  "id",    1};
+    PDMlib::ContainerInfo velocity   = {"Velocity",   "N/A", "none", PDMlib::FLOAT,  "vel",   3, PDMlib::IJKN};
+    pdmlib.AddContainer(coordinate);
+    pdmlib.AddContainer(id);
+    pdmlib.AddContainer(velocity);
+
+    // Rank毎に粒子数を変えて偏らせる
+    // 粒子のIDから、座標のy成分と速度の各成分が決まるようにしておく
+    const size_t num_local = 1000*(my_rank+1);
+    const long   num_total = 500*num_procs*(num_procs+1);
+    size_t       n         = num_local;
+    double*      x         = new double[3*n];
+    long*        ids       = new long[n];
+    float*       v         = new float[3*n];
+    std::srand(my_rank+1);
+    for(size_t i = 0; i < n; i++)
+    {
+        ids[i]     = 1000*my_rank*(my_rank+1)/2+i;
+        x[3*i]     = (double)std::rand()/RAND_MAX*100;
+        x[3*i+1]   = ids[i];
+        x[3*i+2]   = 0;
+        v[i]       = ids[i]%1000;
+        v[n+i]     = ids[i]/1000;
+        v[2*n+i]   = -1;
+    }
+    pdmlib.RegisterContainer("Coordinate", &x);
+    pdmlib.RegisterContainer("ID",         &ids);
+    pdmlib.RegisterContainer("Velocity",   &v);
+
+    for(int iteration = 0; iteration < 3; iteration++)
+    {
+        // 失敗したRankだけが抜けると他のRankが集団通信で止まるので、結果は集約してから判定する
+        const size_t rt = pdmlib.Rebalance(n);
+        EXPECT_NE((size_t)-1, rt);
+        n = rt != (size_t)-1 ? rt : 0;
+
+        // 粒子数とIDの合計が保存され、各コンテナの粒子の対応が崩れていないこと
+        long local[3] = {(long)n, 0, rt != (size_t)-1 ? 0 : 1};
+        for(size_t i = 0; i < n; i++)
+        {
+            local[1] += ids[i];
+            if(ids[i] != x[3*i+1] || ids[i]%1000 != v[i] || ids[i]/1000 != v[n+i] || v[2*n+i] != -1) local[2]++;
+        }
+        EXPECT_EQ(0, local[2]);
+        long global[3];
+        MPI_Allreduce(local, global, 3, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+        ASSERT_EQ(0, global[2]);
+        EXPECT_EQ(num_total, global[0]);
+        EXPECT_EQ(num_total*(num_total-1)/2, global[1]);
+
+        // 再分割後は粒子数が偏らないこと
+        long max_particles;
+        MPI_Allreduce(&(local[0]), &max_particles, 1, MPI_LONG, MPI_MAX, MPI_COMM_WORLD);
+        EXPECT_LE(max_particles, 1.2*num_total/num_procs);
+
+        // 粒子を動かして、次の呼び出しでカットをまたいだ粒子を移動させる
+        for(size_t i = 0; i < n; i++)
+        {
+            x[3*i] += 7;
+            if(x[3*i] > 100) x[3*i] -= 100;
+        }
+    }
+
+    // 登録されていないコンテナは座標として使えない
+    EXPECT_EQ((size_t)-1, pdmlib.Rebalance(n, "NoSuchContainer"));
+    delete[] x;
+    delete[] ids;
+    delete[] v;
+}
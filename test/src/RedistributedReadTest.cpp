@@ -0,0 +1,246 @@
+/*
+ * PDMlib - Particle Data Management library
+ *
+ *
+ * Copyright (c) 2014 Advanced Institute for Computational Science, RIKEN.
+ * All rights reserved.
+ *
+ */
+
+/*
+ * 出力時と異なるRank数でのRead()/ReadAll()のテスト
+ *
+ *   PDMlibのインスタンスはプロセス内で1つなので、UnitTestとは別の実行ファイルにしている
+ *   実行時のディレクトリにdfiファイルが存在しなければデータを出力して終了し
+ *   dfiファイルがあれば、それを読み込んで内容を確認した後にdfiファイルを削除する
+ *   mpirun -np 3 で出力した後に mpirun -np 2 などRank数を変えて実行すること
+ */
+#include <mpi.h>
+#include <iostream>
+#include <string>
+#include "gtest/gtest.h"
+#include "PDMlib.h"
+#include "MetaData.h"
+#include "Utility.h"
+#include "FileUtils.h"
+
+namespace
+{
+const std::string dfi_filename("RedistributedReadTest.dfi");
+
+//! 起動時にdfiファイルがあれば読み込み、無ければ出力を行う
+bool ReadPhase(void)
+{
+    static const bool read_phase = PDMlib::isFile(dfi_filename);
+    return read_phase;
+}
+
+//! 出力時のRank毎の粒子数（ファイル毎に粒子数を変え、読み込み側のRank数で割り切れないようにする）
+size_t NumParticles(const int& rank)
+{
+    return 100*(rank+1)+7;
+}
+
+//! 出力時のRank番号順に全粒子を並べた時の、rankが出力した最初の粒子の番号
+size_t FirstParticle(const int& rank)
+{
+    size_t first = 0;
+    for(int i = 0; i < rank; i++)
+    {
+        first += NumParticles(i);
+    }
+    return first;
+}
+
+//! 通し番号がgの粒子の第k成分
+double Component(const size_t& g, const int& k)
+{
+    return 10.0*g+k;
+}
+
+//! 通し番号firstから連続するn粒子分のデータが読めているかどうかを確認し、一致しない要素数を返す
+size_t CountMismatch(const size_t& first, const size_t& n, const long* ids, const double* nijk, const float* ijkn)
+{
+    size_t num_mismatch = 0;
+    for(size_t i = 0; i < n; i++)
+    {
+        if(ids[i] != (long)(first+i)) num_mismatch++;
+        for(int k = 0; k < 3; k++)
+        {
+            if(nijk[3*i+k] != Component(first+i, k)) num_mismatch++;
+            if(ijkn[k*n+i] != (float)Component(first+i, k)) num_mismatch++;
+        }
+    }
+    return num_mismatch;
+}
+
+//! 読み込み側の準備をして、出力時のRank数を返す
+int InitForRead(void)
+{
+    PDMlib::MetaData meta_data(dfi_filename);
+    meta_data.Read();
+    PDMlib::PDMlib::GetInstance().Init(0, NULL, "RedistributedReadTest_out.dfi", dfi_filename);
+    return meta_data.GetNumProc();
+}
+}
+
+TEST(RedistributedReadTest, write)
+{
+    if(ReadPhase()) return;
+
+    int my_rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    PDMlib::PDMlib& pdmlib = PDMlib::PDMlib::GetInstance();
+    pdmlib.Init(0, NULL, dfi_filename);
+    pdmlib.SetBaseFileName("RedistributedReadTest");
+    // 無圧縮のファイルは必要な範囲だけを読み、圧縮されたファイルは伸張してから取り出す
+    PDMlib::ContainerInfo id   = {"ID",   "N/A", "none", PDMlib::INT64,  "id",   1};
+    PDMlib::ContainerInfo nijk = {"NIJK", "N/A", "none", PDMlib::DOUBLE, "nijk", 3, PDMlib::NIJK};
+    PDMlib::ContainerInfo ijkn = {"IJKN", "N/A", "zip",  PDMlib::FLOAT,  "ijkn", 3, PDMlib::IJKN};
+    pdmlib.AddContainer(id);
+    pdmlib.AddContainer(nijk);
+    pdmlib.AddContainer(ijkn);
+
+    const size_t n     = NumParticles(my_rank);
+    const size_t first = FirstParticle(my_rank);
+    long*        ids   = new long[n];
+    double*      v     = new double[3*n];
+    float*       w     = new float[3*n];
+    for(size_t i = 0; i < n; i++)
+    {
+        ids[i] = first+i;
+        for(int k = 0; k < 3; k++)
+        {
+            v[3*i+k] = Component(first+i, k);
+            w[k*n+i] = Component(first+i, k);
+        }
+    }
+    pdmlib.Write("ID",   n, ids, (long*)NULL,   1, 0, 0.0);
+    pdmlib.Write("NIJK", n, v,   (double*)NULL, 3, 0, 0.0);
+    pdmlib.Write("IJKN", n, w,   (float*)NULL,  3, 0, 0.0);
+    delete[] ids;
+    delete[] v;
+    delete[] w;
+}
+
+// 出力時のRank毎のファイルを、ファイル単位で読み込み側のRankに割り当てる
+TEST(RedistributedReadTest, read)
+{
+    if(!ReadPhase()) return;
+
+    int my_rank, num_procs;
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_procs);
+    const int num_files = InitForRead();
+    EXPECT_NE(num_files, num_procs);
+
+    PDMlib::PDMlib& pdmlib = PDMlib::PDMlib::GetInstance();
+    pdmlib.SetBalancedRead(false);
+    const int start = PDMlib::GetStartIndex(num_files, num_procs, my_rank);
+    const int end   = PDMlib::GetStartIndex(num_files, num_procs, my_rank+1);
+    size_t    n     = 0;
+    for(int i = start; i < end; i++)
+    {
+        n += NumParticles(i);
+    }
+
+    int     time_step = 0;
+    size_t  length    = 0;
+    long*   ids       = NULL;
+    double* v         = NULL;
+    float*  w         = NULL;
+    EXPECT_EQ((int)n,   pdmlib.Read("ID",   &length, &ids, &time_step));
+    length = 0;
+    EXPECT_EQ((int)n*3, pdmlib.Read("NIJK", &length, &v,   &time_step));
+    length = 0;
+    EXPECT_EQ((int)n*3, pdmlib.Read("IJKN", &length, &w,   &time_step));
+    if(n > 0 && ids != NULL && v != NULL && w != NULL)
+    {
+        // 複数のファイルを読んだRankでも、IJKNは成分毎に全ファイル分が連続する
+        EXPECT_EQ((size_t)0, CountMismatch(FirstParticle(start), n, ids, v, w));
+    }
+    delete[] ids;
+    delete[] v;
+    delete[] w;
+}
+
+// 全粒子を読み込み側のRank数で等分し、ファイルの途中から途中までを読む
+TEST(RedistributedReadTest, balanced_read)
+{
+    if(!ReadPhase()) return;
+
+    int my_rank, num_procs;
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_procs);
+    const int num_files = InitForRead();
+
+    PDMlib::PDMlib& pdmlib = PDMlib::PDMlib::GetInstance();
+    pdmlib.SetBalancedRead(true);
+    const int    total = FirstParticle(num_files);
+    const size_t first = PDMlib::GetStartIndex(total, num_procs, my_rank);
+    const size_t n     = PDMlib::GetStartIndex(total, num_procs, my_rank+1)-first;
+
+    int     time_step = 0;
+    size_t  length    = 0;
+    long*   ids       = NULL;
+    double* v         = NULL;
+    float*  w         = NULL;
+    EXPECT_EQ((int)n,   pdmlib.Read("ID",   &length, &ids, &time_step));
+    length = 0;
+    EXPECT_EQ((int)n*3, pdmlib.Read("NIJK", &length, &v,   &time_step));
+    length = 0;
+    EXPECT_EQ((int)n*3, pdmlib.Read("IJKN", &length, &w,   &time_step));
+    if(n > 0 && ids != NULL && v != NULL && w != NULL)
+    {
+        EXPECT_EQ((size_t)0, CountMismatch(first, n, ids, v, w));
+    }
+    delete[] ids;
+    delete[] v;
+    delete[] w;
+}
+
+// ReadAll()でも登録したコンテナに等分した範囲が読み込まれる
+TEST(RedistributedReadTest, balanced_read_all)
+{
+    if(!ReadPhase()) return;
+
+    int my_rank, num_procs;
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_procs);
+    const int num_files = InitForRead();
+
+    PDMlib::PDMlib& pdmlib = PDMlib::PDMlib::GetInstance();
+    pdmlib.SetBalancedRead(true);
+    const int    total = FirstParticle(num_files);
+    const size_t first = PDMlib::GetStartIndex(total, num_procs, my_rank);
+    const size_t n     = PDMlib::GetStartIndex(total, num_procs, my_rank+1)-first;
+
+    long*   ids = NULL;
+    double* v   = NULL;
+    float*  w   = NULL;
+    pdmlib.RegisterContainer("ID",   &ids);
+    pdmlib.RegisterContainer("NIJK", &v);
+    pdmlib.RegisterContainer("IJKN", &w);
+    int time_step = 0;
+    EXPECT_EQ(n, pdmlib.ReadAll(&time_step, false));
+    if(n > 0 && ids != NULL && v != NULL && w != NULL)
+    {
+        EXPECT_EQ((size_t)0, CountMismatch(first, n, ids, v, w));
+    }
+    delete[] ids;
+    delete[] v;
+    delete[] w;
+
+    // 出力時のRank毎の粒子数の合計が保存されていること
+    long local_n = n;
+    long global_n;
+    MPI_Allreduce(&local_n, &global_n, 1, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+    EXPECT_EQ((long)total, global_n);
+
+    // 次回の実行で出力からやり直す
+    MPI_Barrier(MPI_COMM_WORLD);
+    if(my_rank == 0)
+    {
+        FileUtils::RemoveFile(dfi_filename);
+    }
+}
@@ -10,8 +10,16 @@
 #include <vector>
 #include <iostream>
 #include <sstream>
+#include <fstream>
+#include <unistd.h>
 #include "gtest/gtest.h"
 #include "Utility.h"
+#include "MinMax.h"
+#include "FileCatalog.h"
+#include "TimeSliceIndex.h"
+#include "SparseExchange.h"
+#include "MigrationKernel.h"
+#include "FileUtils.h"
 
 
 // int GetStartIndex(const int& N, const int& NumProc, const int& MyRank);
@@ -21,6 +29,50 @@ TEST(GetStartIndexTest, illegal)
 }
 */
 
+TEST(GetBalancedRangesTest, split_files)
+{
+    // 粒子数 {10, 0, 5, 15} を3Rankで分割すると10粒子づつになる
+    std::vector<uint64_t> counts;
+    counts.push_back(10);
+    counts.push_back(0);
+    counts.push_back(5);
+    counts.push_back(15);
+    std::vector<PDMlib::ParticleRange> ranges;
+
+    PDMlib::GetBalancedRanges(counts, 3, 0, &ranges);
+    ASSERT_EQ(1, ranges.size());
+    EXPECT_EQ(0, ranges[0].file);
+    EXPECT_EQ(0, ranges[0].first);
+    EXPECT_EQ(10, ranges[0].count);
+
+    PDMlib::GetBalancedRanges(counts, 3, 1, &ranges);
+    ASSERT_EQ(2, ranges.size());
+    EXPECT_EQ(2, ranges[0].file);
+    EXPECT_EQ(5, ranges[0].count);
+    EXPECT_EQ(3, ranges[1].file);
+    EXPECT_EQ(0, ranges[1].first);
+    EXPECT_EQ(5, ranges[1].count);
+
+    PDMlib::GetBalancedRanges(counts, 3, 2, &ranges);
+    ASSERT_EQ(1, ranges.size());
+    EXPECT_EQ(3, ranges[0].file);
+    EXPECT_EQ(5, ranges[0].first);
+    EXPECT_EQ(10, ranges[0].count);
+}
+
+TEST(GetBalancedRangesTest, reminder)
+{
+    // 余りは前半のRankが1粒子づつ担当し、粒子が無いRankは空になる
+    std::vector<uint64_t> counts(1, 2);
+    std::vector<PDMlib::ParticleRange> ranges;
+    PDMlib::GetBalancedRanges(counts, 3, 1, &ranges);
+    ASSERT_EQ(1, ranges.size());
+    EXPECT_EQ(1, ranges[0].first);
+    EXPECT_EQ(1, ranges[0].count);
+    PDMlib::GetBalancedRanges(counts, 3, 2, &ranges);
+    EXPECT_EQ(0, ranges.size());
+}
+
 //bool is_all_digit(std::string& str);
 TEST(IsAllDigitTest, ok)
 {
@@ -93,3 +145,713 @@ TEST(GetRegionNumberTest, wrong)
     EXPECT_EQ(-2, PDMlib::get_region_number("foo_bar_baz_-00100_aweqah.c", true));
     EXPECT_EQ(-2, PDMlib::get_region_number("foo_bar_baz_-00100_aweqah", true));
 }
+
+//void MinMax::compute(const T* src, T* dst, const size_t& length, const int& NumComp, const bool& NIJK_Flag, T MinMax[8]);
+TEST(ComputeMinMaxTest, scalar)
+{
+    const size_t    length = 10000;
+    std::vector<long> src(length);
+    std::vector<long> dst(length);
+    for(size_t i = 0; i < length; i++)
+    {
+        src[i] = (long)((i*7919)%length)-1234;
+    }
+    long MinMax[8];
+    PDMlib::MinMax::compute(&src[0], &dst[0], length, 1, true, MinMax);
+    EXPECT_EQ(-1234,            MinMax[0]);
+    EXPECT_EQ((long)length-1235, MinMax[1]);
+    EXPECT_TRUE(src == dst);
+}
+TEST(ComputeMinMaxTest, vector)
+{
+    const size_t       length = 5000;
+    std::vector<float> nijk(3*length);
+    std::vector<float> ijkn(3*length);
+    for(size_t i = 0; i < length; i++)
+    {
+        for(size_t c = 0; c < 3; c++)
+        {
+            const float value = (float)i*(c+1)-100.0f;
+            nijk[3*i+c]      = value;
+            ijkn[c*length+i] = value;
+        }
+    }
+    float expected_r_min = 1.0e+30f;
+    float expected_r_max = 0.0f;
+    for(size_t i = 0; i < length; i++)
+    {
+        const float r = std::sqrt(nijk[3*i]*nijk[3*i]+nijk[3*i+1]*nijk[3*i+1]+nijk[3*i+2]*nijk[3*i+2]);
+        expected_r_min = std::min(expected_r_min, r);
+        expected_r_max = std::max(expected_r_max, r);
+    }
+
+    float              MinMax_nijk[8];
+    float              MinMax_ijkn[8];
+    std::vector<float> dst(3*length);
+    PDMlib::MinMax::compute(&nijk[0], &dst[0], length, 3, true, MinMax_nijk);
+    EXPECT_TRUE(nijk == dst);
+    PDMlib::MinMax::compute(&ijkn[0], &dst[0], length, 3, false, MinMax_ijkn);
+    EXPECT_TRUE(ijkn == dst);
+
+    EXPECT_FLOAT_EQ(expected_r_min, MinMax_nijk[0]);
+    EXPECT_FLOAT_EQ(expected_r_max, MinMax_nijk[1]);
+    for(int c = 0; c < 3; c++)
+    {
+        EXPECT_FLOAT_EQ(-100.0f,                    MinMax_nijk[2+2*c]);
+        EXPECT_FLOAT_EQ((float)(length-1)*(c+1)-100.0f, MinMax_nijk[3+2*c]);
+    }
+    for(int i = 0; i < 8; i++)
+    {
+        EXPECT_FLOAT_EQ(MinMax_nijk[i], MinMax_ijkn[i]);
+    }
+}
+TEST(ComputeMinMaxTest, empty)
+{
+    double MinMax[8];
+    PDMlib::MinMax::compute((double*)NULL, (double*)NULL, 0, 3, true, MinMax);
+    EXPECT_GT(MinMax[0], MinMax[1]);
+    EXPECT_GT(MinMax[2], MinMax[3]);
+}
+
+TEST(ReduceMinMaxTest, with_num_particles)
+{
+    int my_rank, num_procs;
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_procs);
+
+    // Rank0はデータ無し、他のRankはRank番号に応じた値を持つ
+    long MinMax[8];
+    for(int i = 0; i < 8; i += 2)
+    {
+        MinMax[i]   = my_rank == 0 ? PDMlib::MinMax::initial_min<long>() : -my_rank;
+        MinMax[i+1] = my_rank == 0 ? PDMlib::MinMax::initial_max<long>() : my_rank*10;
+    }
+    uint64_t num_particles = my_rank*100;
+    const bool has_data    = PDMlib::MinMax::reduce(MinMax, &num_particles, MPI_COMM_WORLD);
+    if(my_rank != 0) return;
+
+    EXPECT_EQ(num_procs > 1, has_data);
+    EXPECT_EQ((uint64_t)50*num_procs*(num_procs-1), num_particles);
+    if(num_procs > 1)
+    {
+        EXPECT_EQ(-(num_procs-1), MinMax[6]);
+        EXPECT_EQ((num_procs-1)*10, MinMax[7]);
+    }
+}
+
+TEST(ReduceMinMaxTest, int64_beyond_double)
+{
+    int my_rank, num_procs;
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_procs);
+
+    // doubleでは表現できない2^53を越える値と粒子数が丸められずに集約されること
+    // 最後のRankはデータ無し（np=1の時は除く）
+    const bool    empty = num_procs > 1 && my_rank == num_procs-1;
+    const long    base  = (1L<<60)+1;
+    long          MinMax[8];
+    for(int i = 0; i < 8; i += 2)
+    {
+        MinMax[i]   = empty ? PDMlib::MinMax::initial_min<long>() : base+my_rank;
+        MinMax[i+1] = empty ? PDMlib::MinMax::initial_max<long>() : base+my_rank*3;
+    }
+    uint64_t num_particles = empty ? 0 : (1ULL<<53)+1;
+    const bool has_data    = PDMlib::MinMax::reduce(MinMax, &num_particles, MPI_COMM_WORLD);
+    if(my_rank != 0) return;
+
+    const int num_data_procs = num_procs > 1 ? num_procs-1 : 1;
+    EXPECT_TRUE(has_data);
+    EXPECT_EQ(((1ULL<<53)+1)*num_data_procs, num_particles);
+    for(int i = 0; i < 8; i += 2)
+    {
+        EXPECT_EQ(base, MinMax[i]);
+        EXPECT_EQ(base+(num_data_procs-1)*3, MinMax[i+1]);
+    }
+}
+
+TEST(SparseExchangeTest, neighbours)
+{
+    int my_rank, num_procs;
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_procs);
+
+    // 次のRankにはRank番号+1バイト、自Rankには1バイト送る（その他のRankとは通信しない）
+    PDMlib::MessageMap send_buffs;
+    const int next = (my_rank+1)%num_procs;
+    send_buffs[next].assign(my_rank+1, (char)my_rank);
+    send_buffs[my_rank].push_back((char)(my_rank+100));
+
+    PDMlib::MessageMap recv_buffs;
+    PDMlib::SparseExchange(send_buffs, &recv_buffs, MPI_COMM_WORLD, 10);
+
+    const int prev = (my_rank+num_procs-1)%num_procs;
+    if(prev == my_rank)
+    {
+        ASSERT_EQ(1u, recv_buffs.size());
+        EXPECT_EQ(2u, recv_buffs[my_rank].size());
+        return;
+    }
+    ASSERT_EQ(2u, recv_buffs.size());
+    EXPECT_EQ(std::vector<char>(prev+1, (char)prev), recv_buffs[prev]);
+    EXPECT_EQ(std::vector<char>(1, (char)(my_rank+100)), recv_buffs[my_rank]);
+}
+
+TEST(MakeKeepListTest, compaction)
+{
+    std::vector<char> exported(10, 0);
+    exported[0] = 1;
+    exported[3] = 1;
+    exported[9] = 1;
+    std::vector<size_t> kept;
+    PDMlib::MakeKeepList(exported, &kept);
+    const size_t expected[] = {1, 2, 4, 5, 6, 7, 8};
+    EXPECT_EQ(std::vector<size_t>(expected, expected+7), kept);
+
+    // 全て送信した時と、何も送信しなかった時
+    PDMlib::MakeKeepList(std::vector<char>(5, 1), &kept);
+    EXPECT_EQ(0, kept.size());
+    PDMlib::MakeKeepList(std::vector<char>(), &kept);
+    EXPECT_EQ(0, kept.size());
+
+    // スレッド並列で詰める粒子数でも昇順になること
+    const size_t num_particles = 10*PDMlib::MigrationParallelThreshold+3;
+    exported.assign(num_particles, 0);
+    for(size_t i = 0; i < num_particles; i += 3)
+    {
+        exported[i] = 1;
+    }
+    PDMlib::MakeKeepList(exported, &kept);
+    ASSERT_EQ(num_particles-(num_particles+2)/3, kept.size());
+    for(size_t j = 0; j < kept.size(); j++)
+    {
+        ASSERT_EQ(j/2*3+j%2+1, kept[j]);
+    }
+}
+
+//! PackParticles()/UnpackParticles()のテスト用に、3成分のコンテナ1つ分のメッセージを作る
+//
+//粒子iの成分kの値は base+i*10+k とする
+template<typename T>
+std::vector<char> make_migration_message(const size_t& num_objs, const T& base)
+{
+    std::vector<char> buff(sizeof(uint64_t)+PDMlib::AlignedSize(num_objs*3*sizeof(T)), 0);
+    const uint64_t    count = num_objs;
+    memcpy(&(buff[0]), &count, sizeof(uint64_t));
+    T* data = (T*)&(buff[sizeof(uint64_t)]);
+    for(size_t i = 0; i < num_objs; i++)
+    {
+        for(size_t k = 0; k < 3; k++)
+        {
+            data[i*3+k] = base+i*10+k;
+        }
+    }
+    return buff;
+}
+
+class PackUnpackParticlesTest: public ::testing::TestWithParam<bool>
+{
+protected:
+    //! 粒子iの成分kの値が i*10+k になる3成分のコンテナを作る
+    template<typename T>
+    T* make_container(const size_t& num_particles) const
+    {
+        T* container = new T[num_particles*3];
+        for(size_t i = 0; i < num_particles; i++)
+        {
+            for(size_t k = 0; k < 3; k++)
+            {
+                at(container, num_particles, i, k) = i*10+k;
+            }
+        }
+        return container;
+    }
+
+    //! VectorOrderに応じて粒子iの成分kを参照する
+    template<typename T>
+    T& at(T* container, const size_t& num_particles, const size_t& i, const size_t& k) const
+    {
+        return GetParam() ? container[i*3+k] : container[k*num_particles+i];
+    }
+};
+
+TEST_P(PackUnpackParticlesTest, pack)
+{
+    const bool          nijk          = GetParam();
+    const size_t        num_particles = 5;
+    double*             container     = make_container<double>(num_particles);
+    std::vector<size_t> objs;
+    objs.push_back(4);
+    objs.push_back(1);
+
+    // パディングされた領域は書き換えない
+    std::vector<char> buff(PDMlib::AlignedSize(objs.size()*3*sizeof(double))+8, 0x7f);
+    char* next = PDMlib::PackParticles(container, num_particles, 3, nijk, objs, &(buff[0]));
+    EXPECT_EQ(&(buff[0])+objs.size()*3*sizeof(double), next);
+    const double* out = (const double*)&(buff[0]);
+    for(size_t i = 0; i < objs.size(); i++)
+    {
+        for(size_t k = 0; k < 3; k++)
+        {
+            EXPECT_EQ(objs[i]*10+k, out[i*3+k]);
+        }
+    }
+    EXPECT_EQ(0x7f, buff.back());
+
+    // 奇数個の4Byte型は次のコンテナの位置が8Byte境界に揃う
+    int* ints = make_container<int>(num_particles);
+    objs.pop_back();
+    next = PDMlib::PackParticles(ints, num_particles, 3, nijk, objs, &(buff[0]));
+    EXPECT_EQ(&(buff[0])+16, next);
+    EXPECT_EQ(40, ((const int*)&(buff[0]))[0]);
+    EXPECT_EQ(42, ((const int*)&(buff[0]))[2]);
+    delete[] container;
+    delete[] ints;
+}
+
+TEST_P(PackUnpackParticlesTest, unpack_shrink)
+{
+    // 6粒子中3粒子を送信し、2Rankから計2粒子を受信する（領域は確保し直さない）
+    const size_t      num_particles = 6;
+    float*            container     = make_container<float>(num_particles);
+    std::vector<char> exported(num_particles, 0);
+    exported[0] = exported[2] = exported[5] = 1;
+    std::vector<size_t> kept;
+    PDMlib::MakeKeepList(exported, &kept);
+
+    PDMlib::MessageMap recv_buffs;
+    recv_buffs[1] = make_migration_message<float>(1, 1000);
+    recv_buffs[3] = make_migration_message<float>(1, 3000);
+    std::map<int, size_t> positions;
+    positions[1] = positions[3] = sizeof(uint64_t);
+    std::vector<char> scratch;
+
+    float* result = PDMlib::UnpackParticles(container, num_particles, 3, GetParam(), kept, 2, recv_buffs, &positions, &scratch);
+    ASSERT_EQ(container, result);
+    const size_t num_new    = 5;
+    const float  expected[] = {10, 30, 40, 1000, 3000};
+    for(size_t i = 0; i < num_new; i++)
+    {
+        for(size_t k = 0; k < 3; k++)
+        {
+            EXPECT_EQ(expected[i]+k, at(result, num_new, i, k))<<"particle "<<i<<" component "<<k;
+        }
+    }
+    EXPECT_EQ(sizeof(uint64_t)+PDMlib::AlignedSize(3*sizeof(float)), positions[1]);
+    EXPECT_EQ(sizeof(uint64_t)+PDMlib::AlignedSize(3*sizeof(float)), positions[3]);
+    delete[] result;
+}
+
+TEST_P(PackUnpackParticlesTest, unpack_grow)
+{
+    // 4粒子中1粒子を送信し、3粒子を受信する（領域を確保し直す）
+    const size_t      num_particles = 4;
+    long*             container     = make_container<long>(num_particles);
+    std::vector<char> exported(num_particles, 0);
+    exported[1] = 1;
+    std::vector<size_t> kept;
+    PDMlib::MakeKeepList(exported, &kept);
+
+    PDMlib::MessageMap recv_buffs;
+    recv_buffs[2] = make_migration_message<long>(3, 2000);
+    std::map<int, size_t> positions;
+    positions[2] = sizeof(uint64_t);
+    std::vector<char> scratch;
+
+    long* result = PDMlib::UnpackParticles(container, num_particles, 3, GetParam(), kept, 3, recv_buffs, &positions, &scratch);
+    EXPECT_NE(container, result);
+    EXPECT_EQ(0, scratch.size());
+    const size_t num_new    = 6;
+    const long   expected[] = {0, 20, 30, 2000, 2010, 2020};
+    for(size_t i = 0; i < num_new; i++)
+    {
+        for(size_t k = 0; k < 3; k++)
+        {
+            EXPECT_EQ(expected[i]+(long)k, at(result, num_new, i, k))<<"particle "<<i<<" component "<<k;
+        }
+    }
+    delete[] result;
+}
+
+TEST_P(PackUnpackParticlesTest, round_trip)
+{
+    // 並列化される粒子数で、送信した粒子を別のコンテナで受け取る
+    const size_t        num_particles = 3*PDMlib::MigrationParallelThreshold;
+    unsigned int*       src           = make_container<unsigned int>(num_particles);
+    std::vector<size_t> objs;
+    std::vector<char>   exported(num_particles, 0);
+    for(size_t i = 0; i < num_particles; i += 2)
+    {
+        objs.push_back(i);
+        exported[i] = 1;
+    }
+    PDMlib::MessageMap recv_buffs;
+    std::vector<char>& buff  = recv_buffs[0];
+    const uint64_t     count = objs.size();
+    buff.resize(sizeof(uint64_t)+PDMlib::AlignedSize(count*3*sizeof(unsigned int)));
+    memcpy(&(buff[0]), &count, sizeof(uint64_t));
+    PDMlib::PackParticles(src, num_particles, 3, GetParam(), objs, &(buff[sizeof(uint64_t)]));
+
+    std::vector<size_t> kept;
+    PDMlib::MakeKeepList(exported, &kept);
+    std::map<int, size_t> positions;
+    positions[0] = sizeof(uint64_t);
+    std::vector<char> scratch;
+    unsigned int* result = PDMlib::UnpackParticles(src, num_particles, 3, GetParam(), kept, count, recv_buffs, &positions, &scratch);
+    ASSERT_EQ(src, result);
+
+    // 奇数番の粒子が前に、偶数番の粒子が後ろに並ぶ
+    const size_t half = num_particles/2;
+    for(size_t i = 0; i < num_particles; i++)
+    {
+        const size_t original = i < half ? 2*i+1 : 2*(i-half);
+        for(size_t k = 0; k < 3; k++)
+        {
+            ASSERT_EQ(original*10+k, at(result, num_particles, i, k))<<"particle "<<i<<" component "<<k;
+        }
+    }
+    delete[] result;
+}
+
+INSTANTIATE_TEST_CASE_P(VectorOrder, PackUnpackParticlesTest, ::testing::Values(true, false));
+
+TEST(PackedExchangeTest, ring)
+{
+    int my_rank, num_procs;
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_procs);
+
+    // スカラ(int)とIJKNのベクトル(double)の2コンテナを、1つのメッセージで次のRankに送る
+    // 粒子iの値は Rank番号*100+i（ベクトルは成分毎に+0.5ずつ）
+    const size_t num_particles = 4;
+    const int    next          = (my_rank+1)%num_procs;
+    const int    prev          = (my_rank+num_procs-1)%num_procs;
+    int*         scalar        = new int[num_particles];
+    double*      vector        = new double[3*num_particles];
+    for(size_t i = 0; i < num_particles; i++)
+    {
+        scalar[i] = my_rank*100+i;
+        for(size_t k = 0; k < 3; k++)
+        {
+            vector[k*num_particles+i] = my_rank*100+i+0.5*k;
+        }
+    }
+
+    // 先頭からRank番号に応じた数の粒子を送る（intが奇数個の時はパディングが入る）
+    std::vector<size_t> objs;
+    std::vector<char>   exported(num_particles, 0);
+    for(int i = 0; i < my_rank%3+1; i++)
+    {
+        objs.push_back(i);
+        exported[i] = 1;
+    }
+    PDMlib::MessageMap send_buffs;
+    std::vector<char>& buff  = send_buffs[next];
+    const uint64_t     count = objs.size();
+    buff.resize(sizeof(uint64_t)+PDMlib::AlignedSize(count*sizeof(int))+PDMlib::AlignedSize(count*3*sizeof(double)));
+    memcpy(&(buff[0]), &count, sizeof(uint64_t));
+    char* dst = &(buff[sizeof(uint64_t)]);
+    dst = PDMlib::PackParticles(scalar, num_particles, 1, true, objs, dst);
+    dst = PDMlib::PackParticles(vector, num_particles, 3, false, objs, dst);
+    EXPECT_EQ(&(buff[0])+buff.size(), dst);
+
+    PDMlib::MessageMap recv_buffs;
+    PDMlib::SparseExchange(send_buffs, &recv_buffs, MPI_COMM_WORLD, 11);
+    ASSERT_EQ(1, recv_buffs.size());
+    ASSERT_EQ(1, recv_buffs.count(prev));
+    const size_t num_recv = *(const uint64_t*)&(recv_buffs[prev][0]);
+    EXPECT_EQ(prev%3+1, num_recv);
+
+    // 2つ目のコンテナは1つ目のコンテナの後ろから読む
+    std::vector<size_t> kept;
+    PDMlib::MakeKeepList(exported, &kept);
+    std::map<int, size_t> positions;
+    positions[prev] = sizeof(uint64_t);
+    std::vector<char> scratch;
+    scalar = PDMlib::UnpackParticles(scalar, num_particles, 1, true, kept, num_recv, recv_buffs, &positions, &scratch);
+    vector = PDMlib::UnpackParticles(vector, num_particles, 3, false, kept, num_recv, recv_buffs, &positions, &scratch);
+    EXPECT_EQ(recv_buffs[prev].size(), positions[prev]);
+
+    const size_t num_new = kept.size()+num_recv;
+    for(size_t i = 0; i < num_new; i++)
+    {
+        const int expected = i < kept.size() ? my_rank*100+kept[i] : prev*100+(i-kept.size());
+        EXPECT_EQ(expected, scalar[i]);
+        for(size_t k = 0; k < 3; k++)
+        {
+            EXPECT_EQ(expected+0.5*k, vector[k*num_new+i]);
+        }
+    }
+    delete[] scalar;
+    delete[] vector;
+}
+
+TEST(FileCatalogTest, list)
+{
+    // ファイルの作成/削除はRank0だけが行い、build()の前後で同期する
+    int my_rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    const std::string dirname("FileCatalogTest");
+    const char* names[] = {"foo_0_1.x", "foo_1_1.x", "foo_0_1.v", "bar_0_1.x", ".hidden"};
+    const int   num_names = sizeof(names)/sizeof(names[0]);
+    if(my_rank == 0)
+    {
+        PDMlib::RecursiveMkdir(dirname);
+        for(int i = 0; i < num_names; i++)
+        {
+            std::ofstream(std::string(dirname+"/"+names[i]).c_str());
+        }
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    PDMlib::FileCatalog catalog;
+    EXPECT_FALSE(catalog.is_valid());
+    catalog.build(dirname, MPI_COMM_WORLD);
+    EXPECT_TRUE(catalog.is_valid());
+
+    std::vector<std::string> filenames;
+    catalog.list(&filenames);
+    ASSERT_EQ(4, filenames.size());
+    EXPECT_EQ(dirname+"/bar_0_1.x", filenames[0]);
+    EXPECT_EQ(dirname+"/foo_1_1.x", filenames[3]);
+
+    catalog.list(&filenames, "foo_*.x");
+    ASSERT_EQ(2, filenames.size());
+    EXPECT_EQ(dirname+"/foo_0_1.x", filenames[0]);
+    EXPECT_EQ(dirname+"/foo_1_1.x", filenames[1]);
+
+    // 再構築するまではディレクトリの変更は反映されない
+    MPI_Barrier(MPI_COMM_WORLD);
+    if(my_rank == 0)
+    {
+        FileUtils::RemoveFile(dirname+"/foo_1_1.x");
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+    catalog.list(&filenames, "foo_*.x");
+    EXPECT_EQ(2, filenames.size());
+    catalog.build(dirname, MPI_COMM_WORLD);
+    catalog.list(&filenames, "foo_*.x");
+    EXPECT_EQ(1, filenames.size());
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    if(my_rank == 0)
+    {
+        for(int i = 0; i < num_names; i++)
+        {
+            FileUtils::RemoveFile(dirname+"/"+names[i]);
+        }
+        rmdir(dirname.c_str());
+    }
+}
+
+TEST(FileCatalogTest, subdirectories)
+{
+    int my_rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    const std::string dirname("FileCatalogSubdirTest");
+    const char* names[] = {"r0000-0001/foo_0_1.x", "r0000-0001/foo_1_1.x", "r0002-0003/foo_2_1.x"};
+    const int   num_names = sizeof(names)/sizeof(names[0]);
+    if(my_rank == 0)
+    {
+        PDMlib::RecursiveMkdir(dirname+"/r0000-0001");
+        PDMlib::RecursiveMkdir(dirname+"/r0002-0003");
+        for(int i = 0; i < num_names; i++)
+        {
+            std::ofstream(std::string(dirname+"/"+names[i]).c_str());
+        }
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    PDMlib::FileCatalog catalog;
+    catalog.build(dirname, MPI_COMM_WORLD, 2);
+    std::vector<std::string> filenames;
+    catalog.list(&filenames);
+    ASSERT_EQ(3, filenames.size());
+    EXPECT_EQ(dirname+"/"+names[0], filenames[0]);
+    EXPECT_EQ(dirname+"/"+names[2], filenames[2]);
+
+    // 存在しないディレクトリはmust_existがfalseなら空の一覧になる
+    catalog.build(dirname+"/missing", MPI_COMM_WORLD, 2, false);
+    EXPECT_TRUE(catalog.is_valid());
+    catalog.list(&filenames);
+    EXPECT_EQ(0, filenames.size());
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    if(my_rank == 0)
+    {
+        for(int i = 0; i < num_names; i++)
+        {
+            FileUtils::RemoveFile(dirname+"/"+names[i]);
+        }
+        rmdir((dirname+"/r0000-0001").c_str());
+        rmdir((dirname+"/r0002-0003").c_str());
+        rmdir(dirname.c_str());
+    }
+}
+
+TEST(CollectiveMkdirTest, nested)
+{
+    char cwd[4096];
+    ASSERT_TRUE(getcwd(cwd, sizeof(cwd)) != NULL);
+    std::vector<std::string> dirs;
+    dirs.push_back("CollectiveMkdirTest/a/b");
+    dirs.push_back(std::string(cwd)+"/CollectiveMkdirTest/c");
+    EXPECT_TRUE(PDMlib::CollectiveMkdir(dirs, MPI_COMM_WORLD));
+    // 既に存在するディレクトリを指定しても成功する
+    EXPECT_TRUE(PDMlib::CollectiveMkdir(dirs, MPI_COMM_WORLD));
+
+    // ファイルと同じ名前のディレクトリは作れない
+    std::ofstream("CollectiveMkdirTest/file");
+    EXPECT_FALSE(PDMlib::CollectiveMkdir(std::vector<std::string>(1, "CollectiveMkdirTest/file/d"), MPI_COMM_WORLD));
+
+    FileUtils::RemoveFile("CollectiveMkdirTest/file");
+    rmdir("CollectiveMkdirTest/a/b");
+    rmdir("CollectiveMkdirTest/a");
+    rmdir("CollectiveMkdirTest/c");
+    rmdir("CollectiveMkdirTest");
+}
+
+TEST(CollectiveMkdirTest, node_comm)
+{
+    // 作成済のノード内コミュニケータを繰り返し使う
+    MPI_Comm node_comm = PDMlib::SplitNodeComm(MPI_COMM_WORLD);
+    int      node_size;
+    MPI_Comm_size(node_comm, &node_size);
+    EXPECT_LE(1, node_size);
+    EXPECT_TRUE(PDMlib::CollectiveMkdir(std::vector<std::string>(1, "CollectiveMkdirTest2/step_0"), MPI_COMM_WORLD, node_comm));
+    EXPECT_TRUE(PDMlib::CollectiveMkdir(std::vector<std::string>(1, "CollectiveMkdirTest2/step_1"), MPI_COMM_WORLD, node_comm));
+    EXPECT_EQ(0, access("CollectiveMkdirTest2/step_0", F_OK));
+    EXPECT_EQ(0, access("CollectiveMkdirTest2/step_1", F_OK));
+
+    std::ofstream("CollectiveMkdirTest2/file");
+    EXPECT_FALSE(PDMlib::CollectiveMkdir(std::vector<std::string>(1, "CollectiveMkdirTest2/file/d"), MPI_COMM_WORLD, node_comm));
+    MPI_Comm_free(&node_comm);
+
+    MPI_Barrier(MPI_COMM_WORLD);
+    FileUtils::RemoveFile("CollectiveMkdirTest2/file");
+    rmdir("CollectiveMkdirTest2/step_0");
+    rmdir("CollectiveMkdirTest2/step_1");
+    rmdir("CollectiveMkdirTest2");
+}
+
+TEST(TimeSliceIndexTest, round_trip)
+{
+    using namespace PDMlib::TimeSliceIndex;
+    int my_rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    std::ostringstream index_filename_stream;
+    index_filename_stream<<"TimeSliceIndexTest_"<<my_rank<<".index";
+    const std::string index_filename(index_filename_stream.str());
+    std::vector<std::string> names;
+    names.push_back("Coordinate");
+    names.push_back("ID");
+    std::vector<std::string> compressions;
+    compressions.push_back("fpzip");
+    compressions.push_back("none");
+
+    // 2Rank分の出力を1プロセス内で再現する
+    Writer rank0;
+    Writer rank1;
+    rank0.open(index_filename, names, compressions, 0, 2);
+    rank1.open(index_filename, names, compressions, 1, 2);
+    const double min_max[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+    rank0.record(0, 10, 0.5, 100, 1200, min_max);
+    rank0.record(1, 10, 0.5, 100, 400, NULL);
+    rank1.record(0, 10, 0.5, 50, 600, min_max);
+    rank1.record(1, 10, 0.5, 50, 200, NULL);
+    rank0.record(0, 20, 1.0, 120, 1440, min_max, 1000);
+    rank0.record(1, 20, 1.0, 120, 480, NULL);
+    rank0.close();
+
+    // Rank1がタイムステップ20を書き込む前は、20は未完了
+    Reader reader;
+    ASSERT_TRUE(reader.load(index_filename));
+    ASSERT_EQ(2, reader.size());
+    EXPECT_EQ(2, reader.get_num_procs());
+    EXPECT_EQ(1, reader.container_index("ID"));
+    EXPECT_EQ("fpzip", reader.compression(0));
+    EXPECT_TRUE(reader.is_complete(0));
+    EXPECT_FALSE(reader.is_complete(1));
+    EXPECT_EQ(0, reader.latest_complete());
+    EXPECT_EQ(-1, reader.find(20));
+
+    rank1.record(0, 20, 1.0, 60, 720, min_max);
+    rank1.record(1, 20, 1.0, 60, 240, NULL);
+    ASSERT_TRUE(reader.load(index_filename));
+    EXPECT_EQ(1, reader.latest_complete());
+    EXPECT_EQ(20, reader.time_step(1));
+    EXPECT_DOUBLE_EQ(1.0, reader.time(1));
+    EXPECT_EQ(60, reader.num_particles(1, 0, 1));
+    EXPECT_EQ(240, reader.num_bytes(1, 1, 1));
+    // 集約した合計が無い時は各Rankの行を合計する
+    EXPECT_EQ(180, reader.total_particles(1, 1));
+    EXPECT_EQ(1000, reader.total_particles(1, 0));
+
+    double result[8];
+    EXPECT_TRUE(reader.min_max(0, 0, result));
+    EXPECT_DOUBLE_EQ(7, result[7]);
+    EXPECT_FALSE(reader.min_max(0, 1, result));
+
+    std::vector<int> steps;
+    reader.complete_steps(&steps);
+    ASSERT_EQ(2, steps.size());
+    EXPECT_EQ(10, steps[0]);
+    EXPECT_EQ(20, steps[1]);
+
+    reader.unload();
+    FileUtils::RemoveFile(index_filename);
+}
+
+TEST(TimeSliceIndexTest, collective_record)
+{
+    using namespace PDMlib::TimeSliceIndex;
+    int my_rank;
+    int num_procs;
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &num_procs);
+    const std::string index_filename("TimeSliceIndexTest_collective.index");
+    std::vector<std::string> names(1, "ID");
+    std::vector<std::string> compressions(1, "none");
+
+    // Rank0がファイルを作り直してから他のRankが書き込む
+    Writer writer;
+    writer.open(index_filename, names, compressions, my_rank, num_procs);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    // MinMax、粒子数、出力サイズを1回の集団通信で集めて記録する
+    int                   min_max[8] = {my_rank, my_rank+1, 0, 0, 0, 0, 0, 0};
+    uint64_t              total      = 10+my_rank;
+    std::vector<uint64_t> rows;
+    EXPECT_TRUE(PDMlib::MinMax::gather(min_max, &total, 100+my_rank, &rows, MPI_COMM_WORLD));
+    double min_max_d[8];
+    for(int i = 0; i < 8; i++) min_max_d[i] = min_max[i];
+    writer.record(0, 10, 0.5, 10+my_rank, 100+my_rank, min_max_d, total, true, rows.empty() ? NULL : &(rows[0]));
+    writer.close();
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    // 全Rankの行がRank0の1回の書き込みで揃っている
+    // 失敗しても他のRankが集団通信で待たないように、ASSERTは使わない
+    if(my_rank == 0)
+    {
+        Reader reader;
+        EXPECT_TRUE(reader.load(index_filename));
+        EXPECT_EQ(1, reader.size());
+        if(reader.size() == 1)
+        {
+            EXPECT_TRUE(reader.is_complete(0));
+            EXPECT_EQ(0, reader.latest_complete());
+            EXPECT_EQ(10*num_procs+num_procs*(num_procs-1)/2, reader.total_particles(0, 0));
+            double result[8];
+            EXPECT_TRUE(reader.min_max(0, 0, result));
+            EXPECT_DOUBLE_EQ(0,         result[0]);
+            EXPECT_DOUBLE_EQ(num_procs, result[1]);
+            for(int rank = 0; rank < num_procs; rank++)
+            {
+                EXPECT_EQ(10+rank,  reader.num_particles(0, 0, rank));
+                EXPECT_EQ(100+rank, reader.num_bytes(0, 0, rank));
+            }
+        }
+        reader.unload();
+        FileUtils::RemoveFile(index_filename);
+    }
+    MPI_Barrier(MPI_COMM_WORLD);
+}
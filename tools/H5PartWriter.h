@@ -53,7 +53,7 @@ public:
 
 //! スカラー量を出力
     template<typename T>
-    void WriteScalar(T** ptr, const size_t& length, std::string& container_name, const int& stride = 1, const int& offset = 0)
+    void WriteScalar(const T* ptr, const size_t& length, std::string& container_name, const int& stride = 1, const int& offset = 0)
     {
         // visit の H5Part readerが32bit整数および符号無し整数に対応していないため、整数型は全てint64で出力する
         // @attention unsigned long(符号無し64bit 整数でしか表現できない値（2^63〜2^64)が入っているとデータが壊れる
@@ -62,7 +62,7 @@ public:
             int64_t* buffer = new int64_t[length];
             for(int i = 0; i < length; i++)
             {
-                buffer[i] = (int64_t)((*ptr)[stride*i+offset]);
+                buffer[i] = (int64_t)(ptr[stride*i+offset]);
             }
             write_data(container_name.c_str(), (void*)buffer, H5T_NATIVE_INT64);
             delete buffer;
@@ -70,7 +70,7 @@ public:
             float* buffer = new float[length];
             for(int i = 0; i < length; i++)
             {
-                buffer[i] = (float)((*ptr)[stride*i+offset]);
+                buffer[i] = (float)(ptr[stride*i+offset]);
             }
             write_data(container_name.c_str(), (void*)buffer, H5T_NATIVE_FLOAT);
             delete buffer;
@@ -78,7 +78,7 @@ public:
             double* buffer = new double[length];
             for(int i = 0; i < length; i++)
             {
-                buffer[i] = (double)((*ptr)[stride*i+offset]);
+                buffer[i] = (double)(ptr[stride*i+offset]);
             }
 
             write_data(container_name.c_str(), (void*)buffer, H5T_NATIVE_DOUBLE);
@@ -90,7 +90,7 @@ public:
 
 //! NIJKで格納されているベクトル量を出力
     template<typename T>
-    void WriteVectorNIJK(T** ptr, const size_t& length, std::string& container_name)
+    void WriteVectorNIJK(const T* ptr, const size_t& length, std::string& container_name)
     {
         size_t num_particle = length/3;
         std::string name    = container_name+"x";
@@ -103,32 +103,30 @@ public:
 
 //! IJKNで格納されているベクトル量を出力
     template<typename T>
-    void WriteVectorIJKN(T** ptr, const size_t& length, std::string& container_name)
+    void WriteVectorIJKN(const T* ptr, const size_t& length, std::string& container_name)
     {
         size_t num_particle = length/3;
 
-        T* ptr2             = *ptr;
         std::string name    = container_name+"x";
-        WriteScalar(&ptr2, num_particle, name);
+        WriteScalar(ptr, num_particle, name);
 
-        ptr2 += num_particle;
         name  = container_name+"y";
-        WriteScalar(&ptr2, num_particle, name);
+        WriteScalar(ptr+num_particle, num_particle, name);
 
-        ptr2 += num_particle;
         name  = container_name+"z";
-        WriteScalar(&ptr2, num_particle, name);
+        WriteScalar(ptr+2*num_particle, num_particle, name);
     }
 
     template<typename T>
-    void ReadAndWriteContainer(T** ptr, PDMlib::ContainerInfo container_info, const int& time_step, const bool& coordinate_flag)
+    void ReadAndWriteContainer(PDMlib::ContainerView<T>* view, PDMlib::ContainerInfo container_info, const int& time_step, const bool& coordinate_flag)
     {
         int    tmp_time_step = time_step;
-        size_t length        = -1;
-        if(PDMlib::PDMlib::GetInstance().Read(container_info.Name, &length, ptr, &tmp_time_step) <= 0)
+        if(PDMlib::PDMlib::GetInstance().ReadView(container_info.Name, view, &tmp_time_step) <= 0)
         {
             return;
         }
+        const T*     ptr    = view->Data();
+        const size_t length = view->Length();
 
         std::string label(container_info.Name);
         if(coordinate_flag)
@@ -147,30 +145,29 @@ public:
                 WriteVectorIJKN(ptr, length, label);
             }
         }
-        delete[] *ptr;
     }
 
     void ReadAndWriteContainerSelector(PDMlib::ContainerInfo container_info, const int& time_step, const bool& coordinate_flag)
     {
         if(container_info.Type == PDMlib::INT32)
         {
-            int* ptr = NULL;
-            ReadAndWriteContainer(&ptr, container_info, time_step, coordinate_flag);
+            PDMlib::ContainerView<int> view;
+            ReadAndWriteContainer(&view, container_info, time_step, coordinate_flag);
         }else if(container_info.Type == PDMlib::uINT32){
-            unsigned int* ptr = NULL;
-            ReadAndWriteContainer(&ptr, container_info, time_step, coordinate_flag);
+            PDMlib::ContainerView<unsigned int> view;
+            ReadAndWriteContainer(&view, container_info, time_step, coordinate_flag);
         }else if(container_info.Type == PDMlib::INT64){
-            long* ptr = NULL;
-            ReadAndWriteContainer(&ptr, container_info, time_step, coordinate_flag);
+            PDMlib::ContainerView<long> view;
+            ReadAndWriteContainer(&view, container_info, time_step, coordinate_flag);
         }else if(container_info.Type == PDMlib::uINT64){
-            unsigned long* ptr = NULL;
-            ReadAndWriteContainer(&ptr, container_info, time_step, coordinate_flag);
+            PDMlib::ContainerView<unsigned long> view;
+            ReadAndWriteContainer(&view, container_info, time_step, coordinate_flag);
         }else if(container_info.Type == PDMlib::FLOAT){
-            float* ptr = NULL;
-            ReadAndWriteContainer(&ptr, container_info, time_step, coordinate_flag);
+            PDMlib::ContainerView<float> view;
+            ReadAndWriteContainer(&view, container_info, time_step, coordinate_flag);
         }else if(container_info.Type == PDMlib::DOUBLE){
-            double* ptr = NULL;
-            ReadAndWriteContainer(&ptr, container_info, time_step, coordinate_flag);
+            PDMlib::ContainerView<double> view;
+            ReadAndWriteContainer(&view, container_info, time_step, coordinate_flag);
         }
     }
 
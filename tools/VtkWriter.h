@@ -199,7 +199,7 @@ namespace VtkWriter
         {
           ofs <<"<DataArray ";
           ofs <<"Name=\""<<name<<"\" ";
-          ofs <<"type=\""<<get_type(container[0])<<"\" ";
+          ofs <<"type=\""<<get_type(T())<<"\" ";
           ofs <<"NumberOfComponents=\""<<num_comp<<"\" ";
           ofs <<"format=\""<<format<<"\">"<<std::endl;
           WriteContainer<T>* writer=WriteContainerFactory(format, container);
@@ -233,7 +233,7 @@ namespace VtkWriter
         ofs <<"</VTKFile>"<<std::endl;
       }
       template <typename T>
-        void WritePoints(T* coords, const std::string& format)
+        void WritePoints(const T* coords, const std::string& format)
         {
           WriteStartTag("Points");
           WriteDataArray("Points", 3, num_points, coords, format);